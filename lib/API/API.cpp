@@ -1,5 +1,8 @@
 #include "API.h"
 
+#include <ArduinoJson.h>
+#include <DoseQueue.h>
+
 void API::begin(AsyncWebServer &server) {
   // Set up your API endpoints here
   server.on("/api/example", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -10,6 +13,25 @@ void API::begin(AsyncWebServer &server) {
   server.on(
       "/api/getDosage", HTTP_GET,
       std::bind(&API::handleGetDosageRequest, this, std::placeholders::_1));
+
+  // Handler for "/api/batch/cancel" endpoint, before its parent
+  server.on(
+      "/api/batch/cancel", HTTP_GET,
+      std::bind(&API::handleBatchCancelRequest, this, std::placeholders::_1));
+
+  // Handler for "/api/batch" endpoint
+  server.on("/api/batch", HTTP_GET,
+            std::bind(&API::handleBatchRequest, this, std::placeholders::_1));
+
+  // Handler for "/api/espresso" endpoint
+  server.on(
+      "/api/espresso", HTTP_GET,
+      std::bind(&API::handleEspressoRequest, this, std::placeholders::_1));
+
+  // Handler for "/api/getLastResult" endpoint
+  server.on(
+      "/api/getLastResult", HTTP_GET,
+      std::bind(&API::handleGetLastResultRequest, this, std::placeholders::_1));
 }
 
 void API::handleGetDosageRequest(AsyncWebServerRequest *request) {
@@ -18,9 +40,10 @@ void API::handleGetDosageRequest(AsyncWebServerRequest *request) {
   if (request->hasParam("grams")) {
     String gramsParam = request->getParam("grams")->value();
 
-    // Convert the gramsParam to integer
-    newDosageValue = gramsParam.toFloat();
-    newValueReceived = true;
+    // Convert the gramsParam to float and hand it over
+    if (dosageCallback) {
+      dosageCallback(gramsParam.toFloat());
+    }
 
     // Replace this example response with your actual implementation
     String jsonResponse = "{\"dosage\": \"" + gramsParam + " grams\"}";
@@ -32,10 +55,101 @@ void API::handleGetDosageRequest(AsyncWebServerRequest *request) {
   }
 }
 
-bool API::isNewValueReceived() { return newValueReceived; }
+void API::handleBatchRequest(AsyncWebServerRequest *request) {
+  // doses as a comma separated list of grams, e.g. ?doses=18,18,9
+  if (!request->hasParam("doses")) {
+    request->send(400, "text", "missing parameter");
+    return;
+  }
+  String dosesParam = request->getParam("doses")->value();
+
+  float doses[DoseQueue::CAPACITY];
+  uint8_t count = 0;
+  int start = 0;
+  while (start <= (int)dosesParam.length()) {
+    int end = dosesParam.indexOf(',', start);
+    if (end < 0) {
+      end = dosesParam.length();
+    }
+    float grams = dosesParam.substring(start, end).toFloat();
+    if (grams <= 0.0f || count == DoseQueue::CAPACITY) {
+      request->send(400, "text", "invalid doses");
+      return;
+    }
+    doses[count++] = grams;
+    start = end + 1;
+  }
+
+  if (!batchCallback || !batchCallback(doses, count)) {
+    request->send(409, "text", "not idle or batch already running");
+    return;
+  }
+
+  String jsonResponse = "{\"queued\": " + String(count) + "}";
+  request->send(200, "application/json", jsonResponse);
+}
+
+void API::handleBatchCancelRequest(AsyncWebServerRequest *request) {
+  if (batchCancelCallback) {
+    batchCancelCallback();
+  }
+  request->send(200, "application/json", "{\"cancelled\": true}");
+}
+
+void API::handleEspressoRequest(AsyncWebServerRequest *request) {
+  if (espressoCallback) {
+    espressoCallback();
+  }
+  request->send(200, "application/json", "{\"espresso\": true}");
+}
+
+void API::handleGetLastResultRequest(AsyncWebServerRequest *request) {
+  portENTER_CRITICAL(&resultMux);
+  Result result = lastResult;
+  bool available = hasLastResult;
+  portEXIT_CRITICAL(&resultMux);
+
+  if (!available) {
+    request->send(404, "text", "no result yet");
+    return;
+  }
+
+  StaticJsonDocument<192> doc;
+  doc["target"] = result.target;
+  doc["grams"] = result.grams;
+  doc["seconds"] = result.seconds;
+  doc["topups"] = result.topups;
+  if (result.error) {
+    doc["error"] = result.error;
+  }
+  if (result.timestamp > 0) {
+    doc["timestamp"] = (long)result.timestamp;
+  }
+  String jsonResponse;
+  serializeJson(doc, jsonResponse);
+  request->send(200, "application/json", jsonResponse);
+}
 
-float API::getNewValue() {
-  // Reset the flag after getting the new value
-  newValueReceived = false;
-  return newDosageValue;
-}
\ No newline at end of file
+void API::setLastResult(const Result &result) {
+  portENTER_CRITICAL(&resultMux);
+  lastResult = result;
+  hasLastResult = true;
+  portEXIT_CRITICAL(&resultMux);
+}
+
+void API::onDosage(std::function<void(float grams)> callback) {
+  dosageCallback = callback;
+}
+
+void API::onBatch(
+    std::function<bool(const float *grams, uint8_t count)> callback) {
+  batchCallback = callback;
+}
+
+void API::onBatchCancel(std::function<void()> callback) {
+  batchCancelCallback = callback;
+}
+
+void API::onEspresso(std::function<void()> callback) {
+  espressoCallback = callback;
+}
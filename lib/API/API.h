@@ -1,22 +1,65 @@
 #pragma once
 
 #include <ESPAsyncWebServer.h>
+#include <time.h>
+
+#include <functional>
+
+#include "freertos/FreeRTOS.h"
 
 class API {
 public:
+  // Outcome of the last grind
+  struct Result {
+    float target;
+    float grams;
+    float seconds;
+    uint8_t topups;
+    const char *error;  // nullptr if the grind finished
+    time_t timestamp;   // 0 if the time is not synced
+  };
+
   void begin(AsyncWebServer &server);
 
   // Handler for "/api/getDosage" endpoint
   void handleGetDosageRequest(AsyncWebServerRequest *request);
 
-  // Check if a new value was received since the last call
-  bool isNewValueReceived();
+  // Called with the requested grams, runs on the web server task
+  void onDosage(std::function<void(float grams)> callback);
+
+  // Handler for "/api/batch" endpoint
+  void handleBatchRequest(AsyncWebServerRequest *request);
+
+  // Handler for "/api/batch/cancel" endpoint
+  void handleBatchCancelRequest(AsyncWebServerRequest *request);
+
+  // Called with the doses of a batch, returns false if it was refused.
+  // Runs on the web server task.
+  void onBatch(std::function<bool(const float *grams, uint8_t count)> callback);
+
+  // Called when the batch should stop after the current dose
+  void onBatchCancel(std::function<void()> callback);
+
+  // Handler for "/api/espresso" endpoint
+  void handleEspressoRequest(AsyncWebServerRequest *request);
+
+  // Called when espresso mode should start, runs on the web server task
+  void onEspresso(std::function<void()> callback);
+
+  // Handler for "/api/getLastResult" endpoint
+  void handleGetLastResultRequest(AsyncWebServerRequest *request);
 
-  // Get the new value
-  float getNewValue();
+  // Keep result for "/api/getLastResult"
+  void setLastResult(const Result &result);
 
 private:
-  float newDosageValue = 0;
-  bool newValueReceived = false;
+  std::function<void(float grams)> dosageCallback;
+  std::function<bool(const float *grams, uint8_t count)> batchCallback;
+  std::function<void()> batchCancelCallback;
+  std::function<void()> espressoCallback;
+  Result lastResult = {};
+  bool hasLastResult = false;
+  // the handlers run on the async_tcp task
+  portMUX_TYPE resultMux = portMUX_INITIALIZER_UNLOCKED;
 };
 ;
@@ -0,0 +1,131 @@
+#include "AfterflowModel.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "afterflow";
+
+// prior uncertainty of c0 [g], c1 [s] and c2 [g/s]
+static const float INITIAL_P[3] = {1.0f, 0.5f, 0.001f};
+// assume a prediction error of 0.2 g until there is data
+static const float INITIAL_RESIDUAL_VAR = 0.04f;
+
+AfterflowModel::AfterflowModel() {
+  _name[0] = '\0';
+  initState();
+}
+
+void AfterflowModel::initState() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+  for (uint8_t i = 0; i < N; ++i) {
+    _state.p[i][i] = INITIAL_P[i];
+  }
+  _state.residual_var = INITIAL_RESIDUAL_VAR;
+}
+
+void AfterflowModel::begin(const char *name) {
+  strncpy(_name, name, sizeof(_name) - 1);
+  _name[sizeof(_name) - 1] = '\0';
+
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  State stored;
+  if (prefs.getBytes(_name, &stored, sizeof(stored)) == sizeof(stored) &&
+      stored.magic == MAGIC) {
+    _state = stored;
+  } else {
+    initState();
+  }
+  prefs.end();
+}
+
+void AfterflowModel::save() {
+  if (_name[0] == '\0') {
+    return;
+  }
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(_name, &_state, sizeof(_state));
+  prefs.end();
+}
+
+float AfterflowModel::getResidualStdDev() const {
+  return sqrtf(_state.residual_var);
+}
+
+float AfterflowModel::predict(float rate, float runtime) const {
+  return _state.theta[0] + _state.theta[1] * rate + _state.theta[2] * runtime;
+}
+
+float AfterflowModel::solveRunDuration(float remaining, float rate,
+                                       float elapsed) const {
+  // rate * d + predict(rate, elapsed + d) = remaining
+  float slope = rate + _state.theta[2];
+  if (slope < 0.5f * rate) {
+    // a runtime term that eats most of the flow is not trustworthy
+    slope = rate;
+  }
+  return (remaining - predict(rate, elapsed)) / slope;
+}
+
+bool AfterflowModel::learn(float rate, float runtime, float afterflow) {
+  if (afterflow < MIN_AFTERFLOW_G || afterflow > MAX_AFTERFLOW_G) {
+    return false;
+  }
+
+  const float x[N] = {1.0f, rate, runtime};
+  float px[N];
+  float xpx = 0.0f;
+  for (uint8_t i = 0; i < N; ++i) {
+    px[i] = 0.0f;
+    for (uint8_t j = 0; j < N; ++j) {
+      px[i] += _state.p[i][j] * x[j];
+    }
+    xpx += x[i] * px[i];
+  }
+
+  float error = afterflow - predict(rate, runtime);
+  // reject what the model can't explain once it has seen enough grinds
+  if (isTrained() &&
+      error * error > 16.0f * (_state.residual_var + xpx)) {
+    return false;
+  }
+
+  float denom = FORGETTING + xpx;
+  float trace = 0.0f;
+  for (uint8_t i = 0; i < N; ++i) {
+    _state.theta[i] += px[i] / denom * error;
+  }
+  for (uint8_t i = 0; i < N; ++i) {
+    for (uint8_t j = 0; j < N; ++j) {
+      _state.p[i][j] -= px[i] * px[j] / denom;
+    }
+    trace += _state.p[i][i];
+  }
+  // forget, but don't let the covariance wind up beyond the prior
+  float initialTrace = INITIAL_P[0] + INITIAL_P[1] + INITIAL_P[2];
+  if (trace < initialTrace) {
+    for (uint8_t i = 0; i < N; ++i) {
+      for (uint8_t j = 0; j < N; ++j) {
+        _state.p[i][j] /= FORGETTING;
+      }
+    }
+  }
+
+  // the first errors only measure the prior, not the model
+  if (isTrained()) {
+    _state.residual_var = FORGETTING * _state.residual_var +
+                          (1.0f - FORGETTING) * error * error;
+  }
+  if (_state.sessions < UINT16_MAX) {
+    ++_state.sessions;
+  }
+  save();
+  return true;
+}
+
+void AfterflowModel::reset() {
+  initState();
+  save();
+}
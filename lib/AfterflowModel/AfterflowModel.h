@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+
+// Learns how many grams still land in the cup after the relay is switched off.
+//
+// afterflow = c0 + c1 * rate + c2 * runtime
+//
+// rate is the flow rate at the relay-off instant in g/s and runtime the time
+// the grinder was on in seconds. The coefficients are fitted with recursive
+// least squares and a forgetting factor, so the model follows slow changes of
+// beans and grind setting. One observation is added per grind, the state is
+// stored in NVS under the given name after every update.
+class AfterflowModel {
+ public:
+  // sessions needed before the model is trusted
+  static constexpr uint16_t MIN_SESSIONS = 3;
+  static constexpr float FORGETTING = 0.9f;
+  // plausible afterflow range, anything else is a bumped cup
+  static constexpr float MIN_AFTERFLOW_G = -0.5f;
+  static constexpr float MAX_AFTERFLOW_G = 5.0f;
+
+  AfterflowModel();
+
+  // Load the state stored under name (max. 15 characters)
+  void begin(const char *name);
+
+  bool isTrained() const { return _state.sessions >= MIN_SESSIONS; }
+  uint16_t getSessions() const { return _state.sessions; }
+  // Std dev of the prediction error of the recent sessions in grams
+  float getResidualStdDev() const;
+
+  // Expected afterflow in grams
+  float predict(float rate, float runtime) const;
+
+  // Seconds from now until the relay should be switched off so that the cup
+  // ends up at remaining grams more than now, given the current rate and the
+  // runtime so far.
+  float solveRunDuration(float remaining, float rate, float elapsed) const;
+
+  // Add one grind. Returns false if the observation was rejected.
+  bool learn(float rate, float runtime, float afterflow);
+
+  // Forget everything that was learned
+  void reset();
+
+  float getCoefficient(uint8_t i) const { return _state.theta[i]; }
+
+ private:
+  static constexpr uint32_t MAGIC = 0xAF7E0001;
+  static constexpr uint8_t N = 3;
+
+  struct State {
+    uint32_t magic;
+    uint16_t sessions;
+    float theta[N];
+    float p[N][N];
+    float residual_var;
+  };
+
+  void initState();
+  void save();
+
+  char _name[16];
+  State _state;
+};
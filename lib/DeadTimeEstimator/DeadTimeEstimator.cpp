@@ -0,0 +1,69 @@
+#include "DeadTimeEstimator.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "deadtime";
+static const char *PREFS_STATE = "state";
+
+// deviation assumed for the first measurement
+static const float INITIAL_DEVIATION_S = 0.05f;
+
+DeadTimeEstimator::DeadTimeEstimator() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+}
+
+void DeadTimeEstimator::begin() {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  State stored;
+  if (prefs.getBytes(PREFS_STATE, &stored, sizeof(stored)) ==
+          sizeof(stored) &&
+      stored.magic == MAGIC) {
+    _state = stored;
+  }
+  prefs.end();
+}
+
+bool DeadTimeEstimator::addOnDelay(float seconds) {
+  return add(_state.on, seconds);
+}
+
+bool DeadTimeEstimator::addOffDelay(float seconds) {
+  return add(_state.off, seconds);
+}
+
+bool DeadTimeEstimator::add(Estimate &estimate, float seconds) {
+  if (seconds < 0.0f || seconds > MAX_DELAY_S) {
+    return false;
+  }
+
+  if (estimate.count == 0) {
+    estimate.value = seconds;
+    estimate.deviation = INITIAL_DEVIATION_S;
+  } else {
+    float limit = CLIP * fmaxf(estimate.deviation, MIN_DEVIATION_S);
+    float error = constrain(seconds - estimate.value, -limit, limit);
+    estimate.value += ALPHA * error;
+    estimate.deviation += ALPHA * (fabsf(error) - estimate.deviation);
+  }
+  if (estimate.count < UINT16_MAX) {
+    ++estimate.count;
+  }
+  save();
+  return true;
+}
+
+void DeadTimeEstimator::save() {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(PREFS_STATE, &_state, sizeof(_state));
+  prefs.end();
+}
+
+void DeadTimeEstimator::reset() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+  save();
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <stdint.h>
+
+// Keeps running estimates of the two dead times of the grinder:
+//  * on delay: relay on until the first grounds land on the scale
+//  * off delay: relay off until the weight stops rising
+//
+// Both drift with the bean load and the temperature of the grinder. One
+// measurement of each is added per grind. The estimates follow them with an
+// exponential average whose innovations are clipped to CLIP times the mean
+// absolute deviation, so a single bumped cup moves them only a little. The
+// state is stored in NVS after every update.
+class DeadTimeEstimator {
+ public:
+  static constexpr float ALPHA = 0.2f;
+  static constexpr float CLIP = 2.5f;
+  // the deviation never drops below this, or the clip would lock up
+  static constexpr float MIN_DEVIATION_S = 0.01f;
+  // plausible delays, anything else is a measurement gone wrong
+  static constexpr float MAX_DELAY_S = 2.0f;
+
+  DeadTimeEstimator();
+
+  // Load the stored estimates
+  void begin();
+
+  // Add a measurement, returns false if it was rejected
+  bool addOnDelay(float seconds);
+  bool addOffDelay(float seconds);
+
+  // Estimates in seconds, 0 until the first measurement
+  float getOnDelay() const { return _state.on.value; }
+  float getOffDelay() const { return _state.off.value; }
+  // Mean absolute deviation of the measurements in seconds
+  float getOnDeviation() const { return _state.on.deviation; }
+  float getOffDeviation() const { return _state.off.deviation; }
+  uint16_t getSessions() const { return _state.off.count; }
+
+  // Forget everything that was learned
+  void reset();
+
+ private:
+  static constexpr uint32_t MAGIC = 0xDEAD0001;
+
+  struct Estimate {
+    float value;
+    float deviation;
+    uint16_t count;
+  };
+
+  struct State {
+    uint32_t magic;
+    Estimate on;
+    Estimate off;
+  };
+
+  bool add(Estimate &estimate, float seconds);
+  void save();
+
+  State _state;
+};
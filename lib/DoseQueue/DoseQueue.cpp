@@ -0,0 +1,105 @@
+#include "DoseQueue.h"
+
+DoseQueue::DoseQueue()
+    : _grams(), _total(0), _taken(0), _offered(), _offeredCount(0) {}
+
+bool DoseQueue::set(const float *grams, uint8_t count) {
+  if (count == 0 || count > CAPACITY) {
+    return false;
+  }
+  portENTER_CRITICAL(&_mux);
+  bool active = _total > 0;
+  if (!active) {
+    for (uint8_t i = 0; i < count; ++i) {
+      _grams[i] = grams[i];
+    }
+    _total = count;
+    _taken = 0;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return !active;
+}
+
+bool DoseQueue::offer(const float *grams, uint8_t count) {
+  if (count == 0 || count > CAPACITY) {
+    return false;
+  }
+  portENTER_CRITICAL(&_mux);
+  bool active = _total > 0;
+  if (!active) {
+    for (uint8_t i = 0; i < count; ++i) {
+      _offered[i] = grams[i];
+    }
+    _offeredCount = count;
+  }
+  portEXIT_CRITICAL(&_mux);
+  return !active;
+}
+
+bool DoseQueue::hasOffer() const {
+  portENTER_CRITICAL(&_mux);
+  bool offered = _offeredCount > 0;
+  portEXIT_CRITICAL(&_mux);
+  return offered;
+}
+
+bool DoseQueue::take() {
+  portENTER_CRITICAL(&_mux);
+  bool taken = _offeredCount > 0 && _total == 0;
+  if (taken) {
+    for (uint8_t i = 0; i < _offeredCount; ++i) {
+      _grams[i] = _offered[i];
+    }
+    _total = _offeredCount;
+    _taken = 0;
+  }
+  _offeredCount = 0;
+  portEXIT_CRITICAL(&_mux);
+  return taken;
+}
+
+bool DoseQueue::next(float &grams) {
+  portENTER_CRITICAL(&_mux);
+  bool available = _taken < _total;
+  if (available) {
+    grams = _grams[_taken++];
+  }
+  portEXIT_CRITICAL(&_mux);
+  return available;
+}
+
+bool DoseQueue::hasNext() const {
+  portENTER_CRITICAL(&_mux);
+  bool available = _taken < _total;
+  portEXIT_CRITICAL(&_mux);
+  return available;
+}
+
+bool DoseQueue::isActive() const {
+  portENTER_CRITICAL(&_mux);
+  bool active = _total > 0;
+  portEXIT_CRITICAL(&_mux);
+  return active;
+}
+
+uint8_t DoseQueue::getIndex() const {
+  portENTER_CRITICAL(&_mux);
+  uint8_t index = _taken;
+  portEXIT_CRITICAL(&_mux);
+  return index;
+}
+
+uint8_t DoseQueue::getTotal() const {
+  portENTER_CRITICAL(&_mux);
+  uint8_t total = _total;
+  portEXIT_CRITICAL(&_mux);
+  return total;
+}
+
+void DoseQueue::clear() {
+  portENTER_CRITICAL(&_mux);
+  _total = 0;
+  _taken = 0;
+  _offeredCount = 0;
+  portEXIT_CRITICAL(&_mux);
+}
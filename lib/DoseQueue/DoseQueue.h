@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Doses of a batch, ground one after the other into a fresh cup each.
+//
+// Filled from the API (async_tcp task) or a dose button, consumed by the
+// state machine, so every access is guarded. A batch is active from set()
+// until clear(), the dose taken last stays the current one until then.
+//
+// The API only offer()s a batch, the state machine take()s it once it is
+// idle. Another task can never start a batch under a running grind.
+class DoseQueue {
+ public:
+  static constexpr uint8_t CAPACITY = 16;
+
+  DoseQueue();
+
+  // Start a batch of count doses. False if a batch is already active or
+  // count is 0 or more than CAPACITY.
+  bool set(const float *grams, uint8_t count);
+
+  // Hand a batch to the state machine. Replaces an offer that was not taken,
+  // false if a batch is active or count is 0 or more than CAPACITY.
+  bool offer(const float *grams, uint8_t count);
+  bool hasOffer() const;
+  // Start the offered batch, false if there is none or a batch is active
+  bool take();
+
+  // Take the next dose, false once all were taken
+  bool next(float &grams);
+
+  bool hasNext() const;
+  bool isActive() const;
+  // number of the current dose, 1 based, 0 before the first next()
+  uint8_t getIndex() const;
+  uint8_t getTotal() const;
+
+  // End the batch and drop an offer, a dose being ground is finished but
+  // nothing after it
+  void clear();
+
+ private:
+  float _grams[CAPACITY];
+  uint8_t _total;
+  uint8_t _taken;
+  float _offered[CAPACITY];
+  uint8_t _offeredCount;
+  mutable portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+};
@@ -0,0 +1,65 @@
+#include "FlowAnomalyDetector.h"
+
+FlowAnomalyDetector::FlowAnomalyDetector()
+    : _noFlowUs(0),
+      _stallUs(0),
+      _relayOnUs(0),
+      _stallSinceUs(0),
+      _peakRate(0.0f),
+      _emptyPulses(0) {}
+
+void FlowAnomalyDetector::configure(uint32_t noFlowMs, uint32_t stallMs) {
+  _noFlowUs = (int64_t)noFlowMs * 1000;
+  _stallUs = (int64_t)stallMs * 1000;
+}
+
+void FlowAnomalyDetector::start(int64_t relayOnUs) {
+  _relayOnUs = relayOnUs;
+  _stallSinceUs = 0;
+  _peakRate = 0.0f;
+  _emptyPulses = 0;
+}
+
+FlowAnomalyDetector::Anomaly FlowAnomalyDetector::update(int64_t nowUs,
+                                                         bool flowing,
+                                                         float rate,
+                                                         bool converged) {
+  if (!flowing) {
+    _stallSinceUs = 0;
+    if (_noFlowUs > 0 && nowUs - _relayOnUs > _noFlowUs) {
+      return NO_FLOW;
+    }
+    return NONE;
+  }
+
+  if (converged && rate > _peakRate) {
+    _peakRate = rate;
+  }
+  if (_stallUs == 0 || _peakRate <= 0.0f ||
+      rate >= STALL_FRACTION * _peakRate) {
+    _stallSinceUs = 0;
+    return NONE;
+  }
+  if (_stallSinceUs == 0) {
+    _stallSinceUs = nowUs;
+  }
+  return nowUs - _stallSinceUs > _stallUs ? STALL : NONE;
+}
+
+FlowAnomalyDetector::Anomaly FlowAnomalyDetector::addPulse(float grams) {
+  _emptyPulses = grams < EMPTY_PULSE_G ? _emptyPulses + 1 : 0;
+  return _emptyPulses >= MAX_EMPTY_PULSES ? EMPTY_PULSES : NONE;
+}
+
+const char *FlowAnomalyDetector::getName(Anomaly anomaly) {
+  switch (anomaly) {
+    case NO_FLOW:
+      return "no_flow";
+    case STALL:
+      return "stall";
+    case EMPTY_PULSES:
+      return "empty_pulses";
+    default:
+      return "none";
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdint.h>
+
+// Tells a grind that is going nowhere from one that is just slow to start.
+//
+//  * NO_FLOW: the relay has been on for noFlowMs and nothing has landed in
+//    the cup, e.g. an empty hopper
+//  * STALL: the flow rate dropped below STALL_FRACTION of the highest
+//    converged rate of this run and stayed there for stallMs, e.g. a clog or
+//    a hopper that ran empty mid-grind
+//  * EMPTY_PULSES: MAX_EMPTY_PULSES top-ups in a row delivered nothing
+//
+// A timeout of 0 disables the check.
+class FlowAnomalyDetector {
+ public:
+  enum Anomaly : uint8_t {
+    NONE = 0,
+    NO_FLOW,
+    STALL,
+    EMPTY_PULSES,
+  };
+
+  static constexpr float STALL_FRACTION = 0.25f;
+  static constexpr uint8_t MAX_EMPTY_PULSES = 3;
+  // a pulse that delivered less than this is counted as empty
+  static constexpr float EMPTY_PULSE_G = 0.05f;
+
+  FlowAnomalyDetector();
+
+  void configure(uint32_t noFlowMs, uint32_t stallMs);
+
+  // The relay of the main run was switched on at relayOnUs
+  void start(int64_t relayOnUs);
+
+  // Once per sample while the main run is on. flowing is set once the first
+  // grounds landed, rate is the current estimate and converged tells whether
+  // it can be trusted.
+  Anomaly update(int64_t nowUs, bool flowing, float rate, bool converged);
+
+  // Once per top-up with the grams it delivered
+  Anomaly addPulse(float grams);
+
+  static const char *getName(Anomaly anomaly);
+
+ private:
+  int64_t _noFlowUs;
+  int64_t _stallUs;
+  int64_t _relayOnUs;
+  int64_t _stallSinceUs;  // 0 while the rate is fine
+  float _peakRate;
+  uint8_t _emptyPulses;
+};
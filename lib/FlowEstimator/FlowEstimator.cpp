@@ -0,0 +1,62 @@
+#include "FlowEstimator.h"
+
+#include <math.h>
+
+FlowEstimator::FlowEstimator(float measurementNoise, float processNoise)
+    : _r(measurementNoise * measurementNoise),
+      _q(processNoise),
+      _running(false),
+      _timestampUs(0),
+      _weight(0.0f),
+      _rate(0.0f),
+      _p00(0.0f),
+      _p01(0.0f),
+      _p11(0.0f) {}
+
+void FlowEstimator::reset(float grams, float rate, float rateStdDev,
+                          int64_t timestampUs) {
+  _running = true;
+  _timestampUs = timestampUs;
+  _weight = grams;
+  _rate = rate;
+  _p00 = _r;
+  _p01 = 0.0f;
+  _p11 = rateStdDev * rateStdDev;
+}
+
+void FlowEstimator::update(float grams, int64_t timestampUs) {
+  if (!_running) {
+    return;
+  }
+
+  // predict
+  float dt = (timestampUs - _timestampUs) / 1000000.0f;
+  if (dt > 0) {
+    float dt2 = dt * dt;
+    _weight += _rate * dt;
+    _p00 += 2 * dt * _p01 + dt2 * _p11 + _q * dt2 * dt / 3;
+    _p01 += dt * _p11 + _q * dt2 / 2;
+    _p11 += _q * dt;
+    _timestampUs = timestampUs;
+  }
+
+  // correct
+  float innovation = grams - _weight;
+  float s = _p00 + _r;
+  float k0 = _p00 / s;
+  float k1 = _p01 / s;
+  _weight += k0 * innovation;
+  _rate += k1 * innovation;
+  _p11 -= k1 * _p01;
+  _p01 -= k0 * _p01;
+  _p00 -= k0 * _p00;
+}
+
+float FlowEstimator::getRateStdDev() const { return sqrtf(_p11); }
+
+int64_t FlowEstimator::predictTimeOf(float grams) const {
+  if (!(_rate > 0)) {
+    return 0;
+  }
+  return _timestampUs + (int64_t)((grams - _weight) / _rate * 1000000.0f);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+
+// Kalman filter tracking weight and flow rate together.
+//
+// State is [weight (g), rate (g/s)] with a constant rate model, the rate is
+// allowed to wander with white noise acceleration. Every scale sample is one
+// weight measurement. Next to the estimates the filter keeps their covariance,
+// so callers can tell how far the rate can be trusted.
+class FlowEstimator {
+ public:
+  // measurementNoise: std dev of one weight reading (g)
+  // processNoise: spectral density of the rate random walk ((g/s)^2 / s)
+  FlowEstimator(float measurementNoise = 0.03f, float processNoise = 0.02f);
+
+  // Start tracking at timestampUs with an initial guess for the rate
+  void reset(float grams, float rate, float rateStdDev, int64_t timestampUs);
+
+  // Predict to timestampUs and fold in one weight reading
+  void update(float grams, int64_t timestampUs);
+
+  bool isRunning() const { return _running; }
+  void stop() { _running = false; }
+
+  float getWeight() const { return _weight; }
+  float getRate() const { return _rate; }
+  float getRateStdDev() const;
+  int64_t getTimestamp() const { return _timestampUs; }
+
+  // When the estimated weight will reach grams at the current rate.
+  // Returns 0 if the rate is not positive.
+  int64_t predictTimeOf(float grams) const;
+
+ private:
+  float _r;  // measurement variance
+  float _q;  // process noise density
+
+  bool _running;
+  int64_t _timestampUs;
+  float _weight;
+  float _rate;
+  // covariance, symmetric
+  float _p00, _p01, _p11;
+};
@@ -0,0 +1,147 @@
+#include "MarginTuner.h"
+
+#include <ArduinoJson.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "tuner";
+static const char *PREFS_HISTORY = "history";
+
+namespace {
+struct Stored {
+  uint32_t magic;
+  uint8_t next;
+  uint8_t count;
+  MarginTuner::Session history[MarginTuner::HISTORY_SIZE];
+};
+}  // namespace
+
+MarginTuner::MarginTuner()
+    : _next(0), _count(0), _mux(portMUX_INITIALIZER_UNLOCKED) {
+  memset(_history, 0, sizeof(_history));
+}
+
+void MarginTuner::begin(AsyncWebServer &server) {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  Stored *stored = new Stored;
+  if (prefs.getBytes(PREFS_HISTORY, stored, sizeof(Stored)) ==
+          sizeof(Stored) &&
+      stored->magic == MAGIC && stored->next < HISTORY_SIZE &&
+      stored->count <= HISTORY_SIZE) {
+    memcpy(_history, stored->history, sizeof(_history));
+    _next = stored->next;
+    _count = stored->count;
+  }
+  delete stored;
+  prefs.end();
+
+  // "/api/tuning" also matches its sub paths, so it has to come last
+  server.on("/api/tuning/reset", HTTP_GET,
+            std::bind(&MarginTuner::handleReset, this, std::placeholders::_1));
+  server.on(
+      "/api/tuning", HTTP_GET,
+      std::bind(&MarginTuner::handleHistory, this, std::placeholders::_1));
+}
+
+float MarginTuner::record(uint8_t slot, uint8_t profile, float target,
+                          float finalGrams, uint8_t topups, float margin,
+                          bool tune) {
+  float error = finalGrams - target;
+  float next = margin;
+  if (tune) {
+    float step = 0.0f;
+    if (error > TOLERANCE_G) {
+      step = GAIN * error;
+    } else if (topups > 0) {
+      step = -TOPUP_STEP_G * topups;
+    }
+    step = constrain(step, -MAX_STEP_G, MAX_STEP_G);
+    next = constrain(margin + step, 0.0f, MAX_MARGIN_G);
+  }
+
+  Session session;
+  session.target = target;
+  session.error = error;
+  session.margin = margin;
+  session.topups = topups;
+  session.slot = slot;
+  session.tuned = next != margin;
+  session.profile = profile;
+
+  portENTER_CRITICAL(&_mux);
+  _history[_next] = session;
+  _next = (_next + 1) % HISTORY_SIZE;
+  if (_count < HISTORY_SIZE) {
+    ++_count;
+  }
+  portEXIT_CRITICAL(&_mux);
+
+  save();
+  return next;
+}
+
+void MarginTuner::reset() {
+  portENTER_CRITICAL(&_mux);
+  _next = 0;
+  _count = 0;
+  portEXIT_CRITICAL(&_mux);
+  save();
+}
+
+void MarginTuner::save() {
+  Stored *stored = new Stored;
+  stored->magic = MAGIC;
+  portENTER_CRITICAL(&_mux);
+  stored->next = _next;
+  stored->count = _count;
+  memcpy(stored->history, _history, sizeof(_history));
+  portEXIT_CRITICAL(&_mux);
+
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(PREFS_HISTORY, stored, sizeof(Stored));
+  prefs.end();
+  delete stored;
+}
+
+void MarginTuner::handleHistory(AsyncWebServerRequest *request) {
+  Session history[HISTORY_SIZE];
+  uint8_t next, count;
+  portENTER_CRITICAL(&_mux);
+  memcpy(history, _history, sizeof(history));
+  next = _next;
+  count = _count;
+  portEXIT_CRITICAL(&_mux);
+
+  DynamicJsonDocument doc(4096);
+  JsonArray sessions = doc.createNestedArray("sessions");
+  float errorSum = 0.0f;
+  unsigned int topups = 0;
+  // oldest first
+  uint8_t first = (next + HISTORY_SIZE - count) % HISTORY_SIZE;
+  for (uint8_t i = 0; i < count; ++i) {
+    const Session &s = history[(first + i) % HISTORY_SIZE];
+    JsonObject session = sessions.createNestedObject();
+    session["slot"] = s.slot;
+    session["profile"] = s.profile;
+    session["target"] = s.target;
+    session["error"] = s.error;
+    session["margin"] = s.margin;
+    session["topups"] = s.topups;
+    session["tuned"] = s.tuned != 0;
+    errorSum += s.error;
+    topups += s.topups;
+  }
+  doc["count"] = count;
+  doc["mean_error"] = count > 0 ? errorSum / count : 0.0f;
+  doc["topups"] = topups;
+
+  String response;
+  serializeJson(doc, response);
+  request->send(200, "application/json", response);
+}
+
+void MarginTuner::handleReset(AsyncWebServerRequest *request) {
+  reset();
+  request->send(200, "application/json", "{\"count\":0}");
+}
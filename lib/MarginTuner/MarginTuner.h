@@ -0,0 +1,71 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Tunes the top-up margins from the outcome of each grind.
+//
+// Every finished session is appended to a history (kept in NVS) with its
+// final error, the number of top-ups and the margin that was used. The margin
+// belongs to the bean profile the session was ground with, it is passed in
+// and handed back, so the tuner itself holds no state per profile. The
+// history is one log of all profiles, each session tagged with its own. If the
+// session stopped on the margin, the margin of its dose button is adjusted:
+//  * an overshoot beyond TOLERANCE_G raises it by GAIN times the overshoot
+//  * each top-up lowers it by TOPUP_STEP_G, a top-up costs time but no coffee
+// A single adjustment is limited to MAX_STEP_G and the margin stays within
+// [0, MAX_MARGIN_G], so a bumped cup can't throw it off.
+//
+// HTTP:
+//  * GET /api/tuning        history and summary as JSON
+//  * GET /api/tuning/reset  forget the history
+class MarginTuner {
+ public:
+  static constexpr uint8_t HISTORY_SIZE = 32;
+  static constexpr float TOLERANCE_G = 0.1f;
+  static constexpr float GAIN = 0.5f;
+  static constexpr float TOPUP_STEP_G = 0.1f;
+  static constexpr float MAX_STEP_G = 0.25f;
+  static constexpr float MAX_MARGIN_G = 3.0f;
+
+  struct Session {
+    float target;
+    float error;   // final grams - target
+    float margin;  // margin the session was started with
+    uint8_t topups;
+    uint8_t slot;
+    uint8_t tuned;    // the margin was adjusted after this session
+    uint8_t profile;  // bean profile the session was ground with
+  };
+
+  MarginTuner();
+
+  // Load the history and add the HTTP handlers
+  void begin(AsyncWebServer &server);
+
+  // Add a finished session. If tune is set, returns the adjusted margin for
+  // the next session of this slot, otherwise margin.
+  float record(uint8_t slot, uint8_t profile, float target, float finalGrams,
+               uint8_t topups, float margin, bool tune);
+
+  void reset();
+
+  uint8_t getCount() const { return _count; }
+
+ private:
+  // the low bits are the version of the stored Session, a history stored
+  // with another one is dropped
+  static constexpr uint32_t MAGIC = 0x7E4E0002;
+
+  void save();
+  void handleHistory(AsyncWebServerRequest *request);
+  void handleReset(AsyncWebServerRequest *request);
+
+  // oldest first once the ring wrapped
+  Session _history[HISTORY_SIZE];
+  uint8_t _next;
+  uint8_t _count;
+  // the HTTP handlers run on the async_tcp task
+  portMUX_TYPE _mux;
+};
@@ -0,0 +1,84 @@
+#include "PortafilterSignatures.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "signature";
+static const char *PREFS_STATE = "state";
+
+PortafilterSignatures::PortafilterSignatures() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+}
+
+void PortafilterSignatures::begin() {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  State stored;
+  if (prefs.getBytes(PREFS_STATE, &stored, sizeof(stored)) ==
+          sizeof(stored) &&
+      stored.magic == MAGIC) {
+    _state = stored;
+  }
+  prefs.end();
+}
+
+bool PortafilterSignatures::isTrained(uint8_t slot) const {
+  return slot < SLOTS && _state.slots[slot].count >= MIN_SESSIONS;
+}
+
+float PortafilterSignatures::getTolerance(uint8_t slot) const {
+  float tolerance = SIGMAS * sqrtf(_state.slots[slot].variance);
+  return constrain(tolerance, MIN_TOLERANCE_G, MAX_TOLERANCE_G);
+}
+
+bool PortafilterSignatures::learn(uint8_t slot, float grams) {
+  if (slot >= SLOTS || grams < MIN_WEIGHT_G) {
+    return false;
+  }
+
+  Signature &signature = _state.slots[slot];
+  if (signature.count == 0) {
+    signature.weight = grams;
+    signature.variance = 0.0f;
+  } else {
+    float error = grams - signature.weight;
+    signature.weight += ALPHA * error;
+    signature.variance =
+        (1.0f - ALPHA) * (signature.variance + ALPHA * error * error);
+  }
+  if (signature.count < UINT16_MAX) {
+    ++signature.count;
+  }
+  save();
+  return true;
+}
+
+int8_t PortafilterSignatures::match(float grams) const {
+  int8_t matched = -1;
+  for (uint8_t slot = 0; slot < SLOTS; ++slot) {
+    if (!isTrained(slot) ||
+        fabsf(grams - _state.slots[slot].weight) > getTolerance(slot)) {
+      continue;
+    }
+    if (matched >= 0) {
+      // same basket for both doses, can't tell which one is meant
+      return -1;
+    }
+    matched = slot;
+  }
+  return matched;
+}
+
+void PortafilterSignatures::save() {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(PREFS_STATE, &_state, sizeof(_state));
+  prefs.end();
+}
+
+void PortafilterSignatures::reset() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+  save();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+
+// Learns what the empty portafilter (or cup) of each dose weighs, so putting
+// it on the scale can be recognized.
+//
+// Every tare of a grind adds the weight that was tared away to the
+// signature of its dose slot, an exponential average with its variance. A
+// weight matches a slot if it is within the tolerance of that signature,
+// SIGMAS standard deviations but at least MIN_TOLERANCE_G. If it would match
+// both slots it is ambiguous and matches neither. Stored in NVS.
+class PortafilterSignatures {
+ public:
+  static constexpr uint8_t SLOTS = 2;
+  // tares needed before a signature is used
+  static constexpr uint16_t MIN_SESSIONS = 2;
+  static constexpr float ALPHA = 0.3f;
+  // lighter things are not a portafilter
+  static constexpr float MIN_WEIGHT_G = 20.0f;
+  static constexpr float SIGMAS = 4.0f;
+  static constexpr float MIN_TOLERANCE_G = 0.5f;
+  static constexpr float MAX_TOLERANCE_G = 5.0f;
+
+  PortafilterSignatures();
+
+  // Load the stored signatures
+  void begin();
+
+  // Add the tared weight of a grind of slot. Returns false if rejected.
+  bool learn(uint8_t slot, float grams);
+
+  // Slot whose signature grams matches, -1 if none or ambiguous
+  int8_t match(float grams) const;
+
+  bool isTrained(uint8_t slot) const;
+  float getWeight(uint8_t slot) const { return _state.slots[slot].weight; }
+  float getTolerance(uint8_t slot) const;
+
+  // Forget everything that was learned
+  void reset();
+
+ private:
+  static constexpr uint32_t MAGIC = 0x5167A001;
+
+  struct Signature {
+    float weight;
+    float variance;
+    uint16_t count;
+  };
+
+  struct State {
+    uint32_t magic;
+    Signature slots[SLOTS];
+  };
+
+  void save();
+
+  State _state;
+};
@@ -0,0 +1,218 @@
+#include "ProfileStore.h"
+
+#include <ArduinoJson.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "profiles";
+static const char *PREFS_STATE = "state";
+
+ProfileStore::ProfileStore()
+    : _request(-1),
+      _resetProfile(-1),
+      _resetGrinder(false),
+      _mux(portMUX_INITIALIZER_UNLOCKED) {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+  for (uint8_t i = 0; i < MAX_PROFILES; ++i) {
+    snprintf(_state.profiles[i].name, NAME_LENGTH, "Profile %u", i + 1);
+  }
+}
+
+void ProfileStore::begin(AsyncWebServer &server) {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  State stored;
+  if (prefs.getBytes(PREFS_STATE, &stored, sizeof(stored)) ==
+          sizeof(stored) &&
+      stored.magic == MAGIC && stored.active < MAX_PROFILES) {
+    _state = stored;
+  }
+  prefs.end();
+
+  // "/api/profile" also matches its sub paths, so it has to come last
+  server.on(
+      "/api/profile/select", HTTP_GET,
+      std::bind(&ProfileStore::handleSelect, this, std::placeholders::_1));
+  server.on(
+      "/api/profile/rename", HTTP_GET,
+      std::bind(&ProfileStore::handleRename, this, std::placeholders::_1));
+  server.on(
+      "/api/profile/reset", HTTP_GET,
+      std::bind(&ProfileStore::handleReset, this, std::placeholders::_1));
+  server.on("/api/profile", HTTP_GET,
+            std::bind(&ProfileStore::handleList, this, std::placeholders::_1));
+}
+
+uint8_t ProfileStore::getActive() const {
+  portENTER_CRITICAL(&_mux);
+  uint8_t active = _state.active;
+  portEXIT_CRITICAL(&_mux);
+  return active;
+}
+
+void ProfileStore::getName(uint8_t index, char *name) const {
+  portENTER_CRITICAL(&_mux);
+  memcpy(name, _state.profiles[index].name, NAME_LENGTH);
+  portEXIT_CRITICAL(&_mux);
+}
+
+bool ProfileStore::load(uint8_t index, Doses &doses) const {
+  portENTER_CRITICAL(&_mux);
+  bool used = _state.profiles[index].used;
+  doses = _state.profiles[index].doses;
+  portEXIT_CRITICAL(&_mux);
+  return used;
+}
+
+void ProfileStore::select(uint8_t index, const Doses &previous) {
+  portENTER_CRITICAL(&_mux);
+  Profile &current = _state.profiles[_state.active];
+  current.doses = previous;
+  current.used = 1;
+  _state.active = index;
+  portEXIT_CRITICAL(&_mux);
+  save();
+}
+
+void ProfileStore::update(const Doses &doses) {
+  portENTER_CRITICAL(&_mux);
+  Profile &current = _state.profiles[_state.active];
+  bool changed =
+      !current.used || memcmp(&current.doses, &doses, sizeof(doses)) != 0;
+  current.doses = doses;
+  current.used = 1;
+  portEXIT_CRITICAL(&_mux);
+  if (changed) {
+    save();
+  }
+}
+
+bool ProfileStore::rename(uint8_t index, const char *name) {
+  if (index >= MAX_PROFILES || name[0] == '\0') {
+    return false;
+  }
+  portENTER_CRITICAL(&_mux);
+  strncpy(_state.profiles[index].name, name, NAME_LENGTH - 1);
+  _state.profiles[index].name[NAME_LENGTH - 1] = '\0';
+  portEXIT_CRITICAL(&_mux);
+  save();
+  return true;
+}
+
+int8_t ProfileStore::takeRequest() {
+  portENTER_CRITICAL(&_mux);
+  int8_t request = _request;
+  _request = -1;
+  portEXIT_CRITICAL(&_mux);
+  return request;
+}
+
+bool ProfileStore::takeResetRequest(int8_t &profile, bool &grinder) {
+  portENTER_CRITICAL(&_mux);
+  profile = _resetProfile;
+  grinder = _resetGrinder;
+  _resetProfile = -1;
+  _resetGrinder = false;
+  portEXIT_CRITICAL(&_mux);
+  return profile >= 0 || grinder;
+}
+
+const char *ProfileStore::getModelKey(char *key, size_t size,
+                                      const char *base, uint8_t index) {
+  if (index == 0) {
+    snprintf(key, size, "%s", base);
+  } else {
+    snprintf(key, size, "%s%u", base, index + 1);
+  }
+  return key;
+}
+
+void ProfileStore::save() {
+  State state;
+  portENTER_CRITICAL(&_mux);
+  state = _state;
+  portEXIT_CRITICAL(&_mux);
+
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(PREFS_STATE, &state, sizeof(state));
+  prefs.end();
+}
+
+int8_t ProfileStore::getIndexParam(AsyncWebServerRequest *request) const {
+  if (!request->hasParam("index")) {
+    return -1;
+  }
+  long index = request->getParam("index")->value().toInt();
+  return index >= 0 && index < MAX_PROFILES ? index : -1;
+}
+
+void ProfileStore::handleList(AsyncWebServerRequest *request) {
+  State state;
+  int8_t pending;
+  portENTER_CRITICAL(&_mux);
+  state = _state;
+  pending = _request;
+  portEXIT_CRITICAL(&_mux);
+
+  StaticJsonDocument<512> doc;
+  doc["active"] = state.active;
+  if (pending >= 0) {
+    doc["pending"] = pending;
+  }
+  JsonArray profiles = doc.createNestedArray("profiles");
+  for (uint8_t i = 0; i < MAX_PROFILES; ++i) {
+    const Profile &p = state.profiles[i];
+    JsonObject profile = profiles.createNestedObject();
+    profile["index"] = i;
+    profile["name"] = p.name;
+    if (p.used) {
+      profile["target_single"] = p.doses.target_single;
+      profile["target_double"] = p.doses.target_double;
+    }
+  }
+
+  String response;
+  serializeJson(doc, response);
+  request->send(200, "application/json", response);
+}
+
+void ProfileStore::handleSelect(AsyncWebServerRequest *request) {
+  int8_t index = getIndexParam(request);
+  if (index < 0) {
+    request->send(400, "text", "invalid index");
+    return;
+  }
+  portENTER_CRITICAL(&_mux);
+  _request = index;
+  portEXIT_CRITICAL(&_mux);
+  request->send(200, "application/json",
+                "{\"pending\": " + String(index) + "}");
+}
+
+void ProfileStore::handleRename(AsyncWebServerRequest *request) {
+  int8_t index = getIndexParam(request);
+  if (index < 0 || !request->hasParam("name") ||
+      !rename(index, request->getParam("name")->value().c_str())) {
+    request->send(400, "text", "invalid parameters");
+    return;
+  }
+  request->send(200, "application/json", "{\"renamed\": true}");
+}
+
+void ProfileStore::handleReset(AsyncWebServerRequest *request) {
+  int8_t index = getIndexParam(request);
+  bool grinder = request->hasParam("grinder") &&
+                 request->getParam("grinder")->value().toInt() != 0;
+  if (index < 0 && !grinder) {
+    request->send(400, "text", "invalid parameters");
+    return;
+  }
+  portENTER_CRITICAL(&_mux);
+  if (index >= 0) {
+    _resetProfile = index;
+  }
+  _resetGrinder = _resetGrinder || grinder;
+  portEXIT_CRITICAL(&_mux);
+  request->send(200, "application/json", "{\"reset_pending\": true}");
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "freertos/FreeRTOS.h"
+
+// Named bean profiles, each with the doses and top-up margins of both
+// buttons. Kept in NVS.
+//
+// This store is the authority on which profile is active and on its doses.
+// The settings hold a working copy of the active one that update() keeps
+// written back here, so settings reset to their defaults are restored from
+// the store at boot instead of overwriting it. The learned models keep their
+// own state, under the key getModelKey() makes for a profile.
+//
+// HTTP:
+//  * GET /api/profile                       all profiles and the active one
+//  * GET /api/profile/select?index=N        switch once the scale is idle
+//  * GET /api/profile/rename?index=N&name=X
+//  * GET /api/profile/reset?index=N         forget what the models of profile
+//                                           N learned, once the scale is idle
+//  * GET /api/profile/reset?grinder=1       the same for the dead times and
+//                                           the portafilters, which belong to
+//                                           the grinder and not to a profile
+class ProfileStore {
+ public:
+  static constexpr uint8_t MAX_PROFILES = 4;
+  static constexpr uint8_t NAME_LENGTH = 16;
+
+  struct Doses {
+    float target_single;
+    float target_double;
+    float margin_single;
+    float margin_double;
+  };
+
+  ProfileStore();
+
+  // Load the profiles and add the HTTP handlers
+  void begin(AsyncWebServer &server);
+
+  uint8_t getActive() const;
+  void getName(uint8_t index, char *name) const;
+
+  // Doses stored for index, false if it was never used
+  bool load(uint8_t index, Doses &doses) const;
+
+  // Put the doses of the active profile away and make index the active one
+  void select(uint8_t index, const Doses &previous);
+
+  // Keep the doses of the active profile, written to NVS only if they changed
+  void update(const Doses &doses);
+
+  bool rename(uint8_t index, const char *name);
+
+  // Switch requested over HTTP, -1 if none. Cleared by the call.
+  int8_t takeRequest();
+
+  // Reset requested over HTTP: profile is the one whose models to reset or
+  // -1, grinder is set for the grinder wide ones. False if none, cleared by
+  // the call.
+  bool takeResetRequest(int8_t &profile, bool &grinder);
+
+  // NVS key of a model of profile index, e.g. "single" or "single2"
+  static const char *getModelKey(char *key, size_t size, const char *base,
+                                 uint8_t index);
+
+ private:
+  static constexpr uint32_t MAGIC = 0xB3A40001;
+
+  struct Profile {
+    char name[NAME_LENGTH];
+    Doses doses;
+    uint8_t used;
+  };
+
+  struct State {
+    uint32_t magic;
+    uint8_t active;
+    Profile profiles[MAX_PROFILES];
+  };
+
+  void save();
+  void handleList(AsyncWebServerRequest *request);
+  void handleSelect(AsyncWebServerRequest *request);
+  void handleRename(AsyncWebServerRequest *request);
+  void handleReset(AsyncWebServerRequest *request);
+  // index parameter of a request, -1 if missing or out of range
+  int8_t getIndexParam(AsyncWebServerRequest *request) const;
+
+  State _state;
+  int8_t _request;
+  int8_t _resetProfile;
+  bool _resetGrinder;
+  // the HTTP handlers run on the async_tcp task
+  mutable portMUX_TYPE _mux;
+};
@@ -0,0 +1,100 @@
+#include "PulseModel.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "pulse";
+
+// a fitted slope below this is noise, not flow
+static const float MIN_SLOPE = 0.1f;
+
+PulseModel::PulseModel() {
+  _name[0] = '\0';
+  initState();
+}
+
+void PulseModel::begin(const char *name) {
+  strncpy(_name, name, sizeof(_name) - 1);
+  _name[sizeof(_name) - 1] = '\0';
+
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  State stored;
+  if (prefs.getBytes(_name, &stored, sizeof(stored)) == sizeof(stored) &&
+      stored.magic == MAGIC) {
+    _state = stored;
+  } else {
+    initState();
+  }
+  prefs.end();
+}
+
+void PulseModel::save() {
+  if (_name[0] == '\0') {
+    return;
+  }
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(_name, &_state, sizeof(_state));
+  prefs.end();
+}
+
+void PulseModel::fit(float rate, float &offset, float &slope) const {
+  float mx = _state.sx / _state.sw;
+  float my = _state.sy / _state.sw;
+  float varx = _state.sxx / _state.sw - mx * mx;
+  slope = rate;
+  if (varx >= MIN_SPREAD_S * MIN_SPREAD_S) {
+    float fitted = (_state.sxy / _state.sw - mx * my) / varx;
+    if (fitted >= MIN_SLOPE) {
+      slope = fitted;
+    }
+  }
+  offset = my - slope * mx;
+}
+
+float PulseModel::predict(float seconds, float rate, float lag) const {
+  if (!isTrained()) {
+    return rate * (seconds - lag);
+  }
+  float offset, slope;
+  fit(rate, offset, slope);
+  return offset + slope * seconds;
+}
+
+float PulseModel::solveDuration(float grams, float rate, float lag) const {
+  if (!isTrained()) {
+    return grams / rate + lag;
+  }
+  float offset, slope;
+  fit(rate, offset, slope);
+  return (grams - offset) / slope;
+}
+
+bool PulseModel::learn(float seconds, float grams) {
+  if (seconds <= 0.0f || seconds > MAX_PULSE_S || grams < MIN_GRAMS ||
+      grams > MAX_GRAMS) {
+    return false;
+  }
+
+  _state.sw = FORGETTING * _state.sw + 1.0f;
+  _state.sx = FORGETTING * _state.sx + seconds;
+  _state.sy = FORGETTING * _state.sy + grams;
+  _state.sxx = FORGETTING * _state.sxx + seconds * seconds;
+  _state.sxy = FORGETTING * _state.sxy + seconds * grams;
+  if (_state.pulses < UINT16_MAX) {
+    ++_state.pulses;
+  }
+  save();
+  return true;
+}
+
+void PulseModel::initState() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+}
+
+void PulseModel::reset() {
+  initState();
+  save();
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+
+// Learns how many grams a top-up pulse delivers for a given pulse length.
+//
+// grams = c0 + c1 * seconds
+//
+// The grinder needs a moment to spin up, so short pulses deliver much less
+// than the rate of the main run suggests; c0 comes out negative and
+// -c0 / c1 is the pulse length that delivers nothing. The line is fitted by
+// least squares over exponentially forgotten sums of the past pulses. As
+// long as the pulses were all about the same length the slope can't be told
+// apart from the offset, then the rate of the main run is used as slope and
+// only the offset is fitted. The sums are stored in NVS after every pulse.
+class PulseModel {
+ public:
+  // pulses needed before the model is trusted
+  static constexpr uint16_t MIN_PULSES = 3;
+  static constexpr float FORGETTING = 0.9f;
+  // spread of pulse lengths (std dev) needed to fit the slope
+  static constexpr float MIN_SPREAD_S = 0.1f;
+  // plausible pulse, anything else is a bumped cup
+  static constexpr float MAX_PULSE_S = 5.0f;
+  static constexpr float MIN_GRAMS = -0.2f;
+  static constexpr float MAX_GRAMS = 5.0f;
+
+  PulseModel();
+
+  // Load the state stored under name (max. 15 characters)
+  void begin(const char *name);
+
+  bool isTrained() const { return _state.pulses >= MIN_PULSES; }
+  uint16_t getPulses() const { return _state.pulses; }
+
+  // Expected grams of a pulse of seconds, rate is the flow of the main run.
+  // lag is the net dead time of the grinder (on delay - off delay), only
+  // used until the model is trained.
+  float predict(float seconds, float rate, float lag = 0.0f) const;
+
+  // Pulse length in seconds to deliver grams. Until the model is trained
+  // this is grams / rate + lag.
+  float solveDuration(float grams, float rate, float lag = 0.0f) const;
+
+  // Add one pulse. Returns false if the observation was rejected.
+  bool learn(float seconds, float grams);
+
+  // Forget everything that was learned
+  void reset();
+
+ private:
+  static constexpr uint32_t MAGIC = 0x9015E001;
+
+  struct State {
+    uint32_t magic;
+    uint16_t pulses;
+    // forgotten sums of 1, x, y, x^2 and x*y
+    float sw;
+    float sx;
+    float sy;
+    float sxx;
+    float sxy;
+  };
+
+  // c0 and c1 for the given fallback slope
+  void fit(float rate, float &offset, float &slope) const;
+  void initState();
+  void save();
+
+  char _name[16];
+  State _state;
+};
@@ -0,0 +1,74 @@
+#include "RatePrior.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "rateprior";
+
+RatePrior::RatePrior() {
+  _name[0] = '\0';
+  initState();
+}
+
+void RatePrior::begin(const char *name) {
+  strncpy(_name, name, sizeof(_name) - 1);
+  _name[sizeof(_name) - 1] = '\0';
+
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  State stored;
+  if (prefs.getBytes(_name, &stored, sizeof(stored)) == sizeof(stored) &&
+      stored.magic == MAGIC) {
+    _state = stored;
+  } else {
+    initState();
+  }
+  prefs.end();
+}
+
+void RatePrior::save() {
+  if (_name[0] == '\0') {
+    return;
+  }
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putBytes(_name, &_state, sizeof(_state));
+  prefs.end();
+}
+
+float RatePrior::getRate(float fallback) const {
+  return isTrained() ? _state.rate : fallback;
+}
+
+float RatePrior::getStdDev(float fallback) const {
+  if (!isTrained()) {
+    return fallback;
+  }
+  return fmaxf(sqrtf(_state.variance), MIN_RELATIVE_STD * _state.rate);
+}
+
+void RatePrior::learn(float rate) {
+  if (_state.sessions == 0) {
+    _state.rate = rate;
+    _state.variance = 0.0f;
+  } else {
+    float error = rate - _state.rate;
+    _state.rate += ALPHA * error;
+    _state.variance =
+        (1.0f - ALPHA) * (_state.variance + ALPHA * error * error);
+  }
+  if (_state.sessions < UINT16_MAX) {
+    ++_state.sessions;
+  }
+  save();
+}
+
+void RatePrior::initState() {
+  memset(&_state, 0, sizeof(_state));
+  _state.magic = MAGIC;
+}
+
+void RatePrior::reset() {
+  initState();
+  save();
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+// Learns the flow rate to expect from a dose before its first gram lands.
+//
+// Keeps an exponential average of the converged flow rate of the recent
+// sessions and of its spread. Once trained it is used as the starting point
+// of the flow estimate, so a provisional stop time can be scheduled right
+// from the start of flow. The state is stored in NVS under the given name.
+class RatePrior {
+ public:
+  // sessions needed before the prior is trusted
+  static constexpr uint16_t MIN_SESSIONS = 2;
+  // weight of the newest session
+  static constexpr float ALPHA = 0.3f;
+  // the spread is never assumed to be below this fraction of the rate, the
+  // estimate has to be able to move away from it
+  static constexpr float MIN_RELATIVE_STD = 0.15f;
+
+  RatePrior();
+
+  // Load the state stored under name (max. 15 characters)
+  void begin(const char *name);
+
+  bool isTrained() const { return _state.sessions >= MIN_SESSIONS; }
+  uint16_t getSessions() const { return _state.sessions; }
+
+  // Expected rate in g/s, fallback until trained
+  float getRate(float fallback) const;
+  // Expected deviation of a session from getRate() in g/s
+  float getStdDev(float fallback) const;
+
+  // Add the converged rate of one session
+  void learn(float rate);
+
+  // Forget everything that was learned
+  void reset();
+
+ private:
+  static constexpr uint32_t MAGIC = 0x4A7E0001;
+
+  struct State {
+    uint32_t magic;
+    uint16_t sessions;
+    float rate;
+    float variance;
+  };
+
+  void initState();
+  void save();
+
+  char _name[16];
+  State _state;
+};
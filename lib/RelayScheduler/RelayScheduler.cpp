@@ -0,0 +1,101 @@
+#include "RelayScheduler.h"
+
+RelayScheduler::RelayScheduler(uint8_t pin)
+    : _pin(pin),
+      _timer(nullptr),
+      _mux(portMUX_INITIALIZER_UNLOCKED),
+      _on(false),
+      _pending(false),
+      _pendingOn(false),
+      _pendingUs(0),
+      _requestedUs(0),
+      _switchedUs(0) {}
+
+bool RelayScheduler::begin() {
+  pinMode(_pin, OUTPUT);
+  set(false);
+
+  esp_timer_create_args_t args = {};
+  args.callback = &RelayScheduler::onTimer;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "relay";
+  return esp_timer_create(&args, &_timer) == ESP_OK;
+}
+
+void RelayScheduler::set(bool on) {
+  cancel();
+  portENTER_CRITICAL(&_mux);
+  write(on, esp_timer_get_time());
+  portEXIT_CRITICAL(&_mux);
+}
+
+void RelayScheduler::schedule(bool on, int64_t at_us) {
+  int64_t now = esp_timer_get_time();
+  if (!_timer || at_us <= now) {
+    cancel();
+    portENTER_CRITICAL(&_mux);
+    write(on, at_us);
+    portEXIT_CRITICAL(&_mux);
+    return;
+  }
+
+  if (_pending && _pendingOn == on && _pendingUs == at_us) {
+    return;
+  }
+  // a late callback of the old time checks _pendingUs and leaves it alone
+  esp_timer_stop(_timer);
+  portENTER_CRITICAL(&_mux);
+  _pendingOn = on;
+  _pendingUs = at_us;
+  _pending = true;
+  portEXIT_CRITICAL(&_mux);
+  esp_timer_start_once(_timer, at_us - now);
+}
+
+void RelayScheduler::cancel() {
+  if (_timer) {
+    esp_timer_stop(_timer);
+  }
+  portENTER_CRITICAL(&_mux);
+  _pending = false;
+  portEXIT_CRITICAL(&_mux);
+}
+
+int64_t RelayScheduler::getRequestedUs() const {
+  portENTER_CRITICAL(&_mux);
+  int64_t requested = _requestedUs;
+  portEXIT_CRITICAL(&_mux);
+  return requested;
+}
+
+int64_t RelayScheduler::getSwitchedUs() const {
+  portENTER_CRITICAL(&_mux);
+  int64_t switched = _switchedUs;
+  portEXIT_CRITICAL(&_mux);
+  return switched;
+}
+
+int64_t RelayScheduler::getLateUs() const {
+  portENTER_CRITICAL(&_mux);
+  int64_t late = _switchedUs - _requestedUs;
+  portEXIT_CRITICAL(&_mux);
+  return late;
+}
+
+void RelayScheduler::write(bool on, int64_t requested_us) {
+  digitalWrite(_pin, on ? HIGH : LOW);
+  _on = on;
+  _requestedUs = requested_us;
+  _switchedUs = esp_timer_get_time();
+}
+
+void RelayScheduler::onTimer(void *arg) {
+  RelayScheduler *self = static_cast<RelayScheduler *>(arg);
+  portENTER_CRITICAL(&self->_mux);
+  if (self->_pending && esp_timer_get_time() >= self->_pendingUs) {
+    self->_pending = false;
+    self->write(self->_pendingOn, self->_pendingUs);
+  }
+  portEXIT_CRITICAL(&self->_mux);
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <Arduino.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+// Switches the grinder relay at a given esp_timer instant.
+//
+// The stop time of a grind is known in advance, but loop() only gets around
+// to check it between display frames and log writes, which adds a few ms of
+// jitter to every stop. A scheduled switch is done by a one-shot esp_timer
+// instead, independent of what the loop is busy with. The time the relay was
+// asked to switch and the time it actually switched are both kept, so the
+// remaining lateness can be logged.
+//
+// schedule() can be called again to move a pending switch, e.g. with every
+// new flow estimate. set() switches right away and cancels a pending switch.
+class RelayScheduler {
+ public:
+  explicit RelayScheduler(uint8_t pin);
+
+  // Set up the pin (off) and the timer
+  bool begin();
+
+  // Switch now
+  void set(bool on);
+
+  // Switch at at_us (esp_timer time), right away if that has passed
+  void schedule(bool on, int64_t at_us);
+
+  // Drop a pending switch, the relay stays as it is
+  void cancel();
+
+  bool isOn() const { return _on; }
+  bool isPending() const { return _pending; }
+
+  // Of the last switch: when it was requested for and when it happened
+  int64_t getRequestedUs() const;
+  int64_t getSwitchedUs() const;
+  // How late the last switch was, 0 for set()
+  int64_t getLateUs() const;
+
+ private:
+  static void onTimer(void *arg);
+  // with _mux held
+  void write(bool on, int64_t requested_us);
+
+  uint8_t _pin;
+  esp_timer_handle_t _timer;
+  // shared with the esp_timer task
+  mutable portMUX_TYPE _mux;
+  volatile bool _on;
+  volatile bool _pending;
+  bool _pendingOn;
+  int64_t _pendingUs;
+  int64_t _requestedUs;
+  int64_t _switchedUs;
+};
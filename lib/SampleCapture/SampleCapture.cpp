@@ -0,0 +1,267 @@
+#include "SampleCapture.h"
+
+#include <ArduinoJson.h>
+
+#include "esp_timer.h"
+
+static const char *CAPTURE_DIR = "/capture";
+
+SampleCapture::SampleCapture()
+    : _task(nullptr),
+      _dropped(0),
+      _enabled(false),
+      _recording(false),
+      _startedUs(0),
+      _sessionBytes(0),
+      _buffered(0),
+      _activeSession(0),
+      _lastSession(0) {}
+
+bool SampleCapture::begin(AsyncWebServer &server, BaseType_t core,
+                          UBaseType_t priority) {
+  if (_task) {
+    return _enabled;
+  }
+  // format on the first boot, the partition was never used before
+  if (!LittleFS.begin(true)) {
+    return false;
+  }
+  if (!LittleFS.exists(CAPTURE_DIR)) {
+    LittleFS.mkdir(CAPTURE_DIR);
+  }
+
+  // continue numbering after the newest session on flash
+  File dir = LittleFS.open(CAPTURE_DIR);
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    uint32_t session = strtoul(f.name(), nullptr, 10);
+    if (session > _lastSession) {
+      _lastSession = session;
+    }
+  }
+
+  // "/capture" also matches its sub paths, so it has to come last
+  server.on("/capture/download", HTTP_GET,
+            std::bind(&SampleCapture::handleDownload, this,
+                      std::placeholders::_1));
+  server.on("/capture", HTTP_GET,
+            std::bind(&SampleCapture::handleList, this, std::placeholders::_1));
+
+  _enabled = true;
+  xTaskCreatePinnedToCore(&SampleCapture::taskEntry, "capture", 4096, this,
+                          priority, &_task, core);
+  return true;
+}
+
+void SampleCapture::beginSession() {
+  if (!_enabled) {
+    return;
+  }
+  Entry entry = {};
+  entry.timestamp_us = esp_timer_get_time();
+  entry.kind = ENTRY_BEGIN;
+  _recording = _queue.push(entry);
+}
+
+void SampleCapture::record(const ScaleSample &sample, bool stable,
+                           bool relayOn, uint8_t state) {
+  if (!_recording) {
+    return;
+  }
+  Entry entry;
+  entry.timestamp_us = sample.timestamp_us;
+  entry.raw = sample.raw;
+  entry.grams = sample.grams;
+  entry.flags = (stable ? CaptureRecord::FLAG_STABLE : 0) |
+                (relayOn ? CaptureRecord::FLAG_RELAY : 0);
+  entry.state = state;
+  entry.sequence = (uint16_t)sample.sequence;
+  entry.kind = ENTRY_RECORD;
+  if (!_queue.push(entry)) {
+    ++_dropped;
+  }
+  if (_queue.size() >= QUEUE_SIZE / 2) {
+    xTaskNotifyGive(_task);
+  }
+}
+
+void SampleCapture::endSession() {
+  if (!_recording) {
+    return;
+  }
+  _recording = false;
+  Entry entry = {};
+  entry.kind = ENTRY_END;
+  // the session file stays open without the end marker, give the writer a
+  // moment to make room
+  for (int i = 0; i < 10 && !_queue.push(entry); ++i) {
+    xTaskNotifyGive(_task);
+    vTaskDelay(1);
+  }
+  xTaskNotifyGive(_task);
+}
+
+void SampleCapture::taskEntry(void *arg) {
+  static_cast<SampleCapture *>(arg)->run();
+}
+
+void SampleCapture::run() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(WRITER_INTERVAL_MS));
+
+    Entry entry;
+    while (_queue.pop(entry)) {
+      switch (entry.kind) {
+        case ENTRY_BEGIN:
+          openSession(entry.timestamp_us);
+          break;
+        case ENTRY_END:
+          closeSession();
+          break;
+        case ENTRY_RECORD:
+          append(entry);
+          break;
+      }
+    }
+  }
+}
+
+String SampleCapture::sessionPath(uint32_t session) {
+  return String(CAPTURE_DIR) + "/" + String(session) + ".bin";
+}
+
+void SampleCapture::makeRoom() {
+  // drop the oldest sessions until there is space for a full one
+  for (;;) {
+    uint32_t oldest = 0;
+    uint8_t count = 0;
+    File dir = LittleFS.open(CAPTURE_DIR);
+    for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+      uint32_t session = strtoul(f.name(), nullptr, 10);
+      if (session > 0 && (oldest == 0 || session < oldest)) {
+        oldest = session;
+      }
+      ++count;
+    }
+    dir.close();
+
+    size_t free = LittleFS.totalBytes() - LittleFS.usedBytes();
+    if (oldest == 0 || (count < MAX_SESSIONS &&
+                        free >= MIN_FREE_BYTES + MAX_SESSION_BYTES)) {
+      return;
+    }
+    LittleFS.remove(sessionPath(oldest));
+  }
+}
+
+void SampleCapture::openSession(int64_t startedUs) {
+  closeSession();
+  makeRoom();
+
+  uint32_t session = _lastSession + 1;
+  _file = LittleFS.open(sessionPath(session), FILE_WRITE);
+  if (!_file) {
+    return;
+  }
+  _lastSession = session;
+
+  CaptureHeader header = {};
+  header.magic = CaptureHeader::MAGIC;
+  header.version = CaptureHeader::VERSION;
+  header.record_size = sizeof(CaptureRecord);
+  header.session = session;
+  header.started_us = startedUs;
+  _file.write((const uint8_t *)&header, sizeof(header));
+
+  _startedUs = startedUs;
+  _sessionBytes = sizeof(header);
+  _buffered = 0;
+  _activeSession = session;
+}
+
+void SampleCapture::closeSession() {
+  if (!_file) {
+    return;
+  }
+  writeBuffer();
+  _file.close();
+  _activeSession = 0;
+}
+
+void SampleCapture::append(const Entry &entry) {
+  if (!_file) {
+    return;
+  }
+  // conversions queued before the session started
+  if (entry.timestamp_us < _startedUs) {
+    return;
+  }
+  if (_sessionBytes + (_buffered + 1) * sizeof(CaptureRecord) >
+      MAX_SESSION_BYTES) {
+    ++_dropped;
+    return;
+  }
+
+  CaptureRecord &record = _buffer[_buffered++];
+  record.offset_us = (uint32_t)(entry.timestamp_us - _startedUs);
+  record.raw = entry.raw;
+  record.grams = entry.grams;
+  record.flags = entry.flags;
+  record.state = entry.state;
+  record.sequence = entry.sequence;
+
+  if (_buffered == BUFFER_RECORDS) {
+    writeBuffer();
+  }
+}
+
+void SampleCapture::writeBuffer() {
+  if (_buffered == 0) {
+    return;
+  }
+  size_t bytes = _buffered * sizeof(CaptureRecord);
+  size_t written = _file.write((const uint8_t *)_buffer, bytes);
+  if (written < bytes) {
+    _dropped += (bytes - written) / sizeof(CaptureRecord);
+  }
+  _sessionBytes += written;
+  _buffered = 0;
+}
+
+void SampleCapture::handleList(AsyncWebServerRequest *request) {
+  StaticJsonDocument<1536> doc;
+  doc["active"] = _activeSession.load();
+  doc["dropped"] = _dropped.load();
+  doc["total_bytes"] = LittleFS.totalBytes();
+  doc["used_bytes"] = LittleFS.usedBytes();
+  JsonArray sessions = doc.createNestedArray("sessions");
+
+  File dir = LittleFS.open(CAPTURE_DIR);
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile()) {
+    JsonObject session = sessions.createNestedObject();
+    session["id"] = strtoul(f.name(), nullptr, 10);
+    session["size"] = f.size();
+  }
+
+  String response;
+  serializeJson(doc, response);
+  request->send(200, "application/json", response);
+}
+
+void SampleCapture::handleDownload(AsyncWebServerRequest *request) {
+  if (!request->hasParam("id")) {
+    request->send(400, "text/plain", "missing parameter");
+    return;
+  }
+  uint32_t session = strtoul(request->getParam("id")->value().c_str(),
+                             nullptr, 10);
+  String path = sessionPath(session);
+  if (session == 0 || !LittleFS.exists(path)) {
+    request->send(404, "text/plain", "unknown session");
+    return;
+  }
+  if (session == _activeSession) {
+    request->send(409, "text/plain", "session is still being recorded");
+    return;
+  }
+  request->send(LittleFS, path, "application/octet-stream", true);
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <LittleFS.h>
+#include <ScaleSampler.h>
+
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// One captured conversion as stored in a session file (little endian).
+struct __attribute__((packed)) CaptureRecord {
+  // the stability verdict the control loop acted on for this sample
+  static constexpr uint8_t FLAG_STABLE = 0x01;
+  static constexpr uint8_t FLAG_RELAY = 0x02;
+
+  uint32_t offset_us;  // DRDY time relative to the session start
+  int32_t raw;         // single raw conversion
+  float grams;         // filtered and tared value
+  uint8_t flags;
+  uint8_t state;       // grinder state machine state
+  uint16_t sequence;   // low bits of the sample sequence, gaps are losses
+};
+
+// Header at the start of each session file, followed by CaptureRecords.
+struct __attribute__((packed)) CaptureHeader {
+  static constexpr uint32_t MAGIC = 0x50414345;  // "ECAP"
+  static constexpr uint16_t VERSION = 1;
+
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t session;
+  uint32_t reserved;
+  int64_t started_us;  // esp_timer time of the session start
+};
+
+// Records every conversion of a grind into a ring of session files on
+// LittleFS, so traces can be downloaded after the fact without a live client.
+//
+// The main loop queues records through a lock-free queue and a low priority
+// writer task batches them into the current session file. Flash writes stall
+// the caches of both cores, so the writer only touches the file in blocks of
+// BUFFER_RECORDS.
+//
+// HTTP:
+//  * GET /capture                 list of sessions as JSON
+//  * GET /capture/download?id=<n> binary session file
+class SampleCapture {
+ public:
+  static constexpr size_t QUEUE_SIZE = 256;
+  static constexpr size_t BUFFER_RECORDS = 256;
+  static constexpr uint8_t MAX_SESSIONS = 16;
+  // limits a session that never ends to roughly 3 minutes at 80 SPS
+  static constexpr size_t MAX_SESSION_BYTES = 256 * 1024;
+  // always leave some room for the rest of the file system
+  static constexpr size_t MIN_FREE_BYTES = 64 * 1024;
+  static constexpr uint32_t WRITER_INTERVAL_MS = 100;
+
+  SampleCapture();
+
+  // Mount the file system, start the writer task and add the HTTP handlers.
+  // Returns false (and stays disabled) if the file system can't be mounted.
+  bool begin(AsyncWebServer &server, BaseType_t core = 0,
+             UBaseType_t priority = 1);
+
+  // Producer side, all from the same task
+  void beginSession();
+  void record(const ScaleSample &sample, bool stable, bool relayOn,
+              uint8_t state);
+  void endSession();
+  bool isRecording() const { return _recording; }
+
+  // Records lost because the writer did not keep up or the flash was full
+  uint32_t getDropped() const { return _dropped.load(); }
+
+ private:
+  enum EntryKind : uint8_t { ENTRY_RECORD, ENTRY_BEGIN, ENTRY_END };
+  struct Entry {
+    int64_t timestamp_us;
+    int32_t raw;
+    float grams;
+    uint8_t flags;
+    uint8_t state;
+    uint16_t sequence;
+    EntryKind kind;
+  };
+
+  static void taskEntry(void *arg);
+  void run();
+  void openSession(int64_t startedUs);
+  void closeSession();
+  void append(const Entry &entry);
+  void writeBuffer();
+  void makeRoom();
+  static String sessionPath(uint32_t session);
+
+  void handleList(AsyncWebServerRequest *request);
+  void handleDownload(AsyncWebServerRequest *request);
+
+  SampleQueue<Entry, QUEUE_SIZE> _queue;
+  TaskHandle_t _task;
+  std::atomic<uint32_t> _dropped;
+  bool _enabled;
+  bool _recording;
+
+  // writer task only
+  File _file;
+  int64_t _startedUs;
+  size_t _sessionBytes;
+  CaptureRecord _buffer[BUFFER_RECORDS];
+  size_t _buffered;
+
+  // 0 while no session file is open
+  std::atomic<uint32_t> _activeSession;
+  std::atomic<uint32_t> _lastSession;
+};
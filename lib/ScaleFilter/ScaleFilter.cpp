@@ -0,0 +1,74 @@
+#include "ScaleFilter.h"
+
+namespace scalefilter {
+
+namespace {
+template <typename Filter>
+RawFilter *instance(void *storage) {
+  static_assert(sizeof(RawFilterAdapter<Filter>) <= FILTER_STORAGE_SIZE,
+                "increase FILTER_STORAGE_SIZE");
+  return new (storage) RawFilterAdapter<Filter>();
+}
+
+RawFilter *selectMovingAverage(uint8_t samples, void *storage) {
+  if (samples >= 48) return instance<MovingAverage<48>>(storage);
+  if (samples >= 24) return instance<MovingAverage<24>>(storage);
+  if (samples >= 12) return instance<MovingAverage<12>>(storage);
+  if (samples >= 8) return instance<MovingAverage<8>>(storage);
+  if (samples >= 4) return instance<MovingAverage<4>>(storage);
+  if (samples >= 2) return instance<MovingAverage<2>>(storage);
+  return instance<MovingAverage<1>>(storage);
+}
+
+// two stages of half the length have about the same delay as one stage of
+// the full length
+RawFilter *selectCascadedBoxcar(uint8_t samples, void *storage) {
+  if (samples >= 48) return instance<CascadedBoxcar<24, 2>>(storage);
+  if (samples >= 24) return instance<CascadedBoxcar<12, 2>>(storage);
+  if (samples >= 12) return instance<CascadedBoxcar<6, 2>>(storage);
+  if (samples >= 8) return instance<CascadedBoxcar<4, 2>>(storage);
+  if (samples >= 4) return instance<CascadedBoxcar<2, 2>>(storage);
+  return selectMovingAverage(samples, storage);
+}
+
+// time constant 2^shift <= samples
+RawFilter *selectIIR(uint8_t samples, void *storage) {
+  if (samples >= 32) return instance<SinglePoleIIR<5>>(storage);
+  if (samples >= 16) return instance<SinglePoleIIR<4>>(storage);
+  if (samples >= 8) return instance<SinglePoleIIR<3>>(storage);
+  if (samples >= 4) return instance<SinglePoleIIR<2>>(storage);
+  if (samples >= 2) return instance<SinglePoleIIR<1>>(storage);
+  return instance<MovingAverage<1>>(storage);
+}
+}  // namespace
+
+RawFilter *selectFilter(FilterType type, uint8_t samples, void *storage) {
+  switch (type) {
+    case CASCADED_BOXCAR:
+      return selectCascadedBoxcar(samples, storage);
+    case IIR:
+      return selectIIR(samples, storage);
+    case MOVING_AVERAGE:
+    default:
+      return selectMovingAverage(samples, storage);
+  }
+}
+
+}  // namespace scalefilter
+
+ScaleFilter::ScaleFilter()
+    : _filter(scalefilter::selectFilter(scalefilter::MOVING_AVERAGE, 1,
+                                        _storage)) {}
+
+void ScaleFilter::configure(uint8_t samples, scalefilter::FilterType type) {
+  // all specializations are trivially destructible, just construct over it
+  _filter = scalefilter::selectFilter(type, samples, _storage);
+}
+
+void ScaleFilter::reset() { _filter->reset(); }
+
+int32_t ScaleFilter::update(int32_t raw) {
+  return _filter->update(scalefilter::toQ(raw));
+}
+
+float ScaleFilter::getGroupDelay() const { return _filter->groupDelay(); }
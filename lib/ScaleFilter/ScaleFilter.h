@@ -0,0 +1,217 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+// Fixed-point filters for raw ADS1232 counts.
+//
+// All filters work on int32 values in Q format with FRAC_BITS fractional bits.
+// A 24 bit conversion shifted by FRAC_BITS still fits into int32, sums are
+// accumulated in int64. Window sizes are template parameters so every
+// specialization divides by a constant and loops can be unrolled.
+//
+// This header has no Arduino dependencies, the filters are bit-exact between
+// the device and a host build.
+namespace scalefilter {
+
+constexpr int FRAC_BITS = 4;
+
+inline int32_t toQ(int32_t raw) { return raw * (1 << FRAC_BITS); }
+inline float fromQ(int32_t q) { return q / (float)(1 << FRAC_BITS); }
+
+// Boxcar over the last N samples. The window is primed with the first sample
+// so the output does not ramp up from zero.
+template <uint8_t N>
+class MovingAverage {
+  static_assert(N > 0, "window must not be empty");
+
+ public:
+  void reset() { _primed = false; }
+
+  int32_t update(int32_t x) {
+    if (!_primed) {
+      for (uint8_t i = 0; i < N; ++i) {
+        _window[i] = x;
+      }
+      _sum = (int64_t)x * N;
+      _index = 0;
+      _primed = true;
+    }
+    _sum += x - _window[_index];
+    _window[_index] = x;
+    _index = (_index + 1 == N) ? 0 : _index + 1;
+    return (int32_t)(_sum / N);
+  }
+
+  static constexpr float groupDelay() { return (N - 1) / 2.0f; }
+
+ private:
+  int32_t _window[N] = {};
+  int64_t _sum = 0;
+  uint8_t _index = 0;
+  bool _primed = false;
+};
+
+// Stages boxcars of length N in series. Approaches a gaussian response with
+// much better stop band than a single boxcar of the same delay.
+template <uint8_t N, uint8_t Stages>
+class CascadedBoxcar {
+  static_assert(Stages > 0, "need at least one stage");
+
+ public:
+  void reset() {
+    for (uint8_t i = 0; i < Stages; ++i) {
+      _stages[i].reset();
+    }
+  }
+
+  int32_t update(int32_t x) {
+    for (uint8_t i = 0; i < Stages; ++i) {
+      x = _stages[i].update(x);
+    }
+    return x;
+  }
+
+  static constexpr float groupDelay() {
+    return Stages * MovingAverage<N>::groupDelay();
+  }
+
+ private:
+  MovingAverage<N> _stages[Stages];
+};
+
+// y += (x - y) / 2^Shift. Time constant of roughly 2^Shift samples.
+template <uint8_t Shift>
+class SinglePoleIIR {
+  static_assert(Shift > 0 && Shift < 16, "shift out of range");
+
+ public:
+  void reset() { _primed = false; }
+
+  int32_t update(int32_t x) {
+    if (!_primed) {
+      _y = x;
+      _primed = true;
+    }
+    // round to nearest instead of towards -inf, in int64 so a full scale
+    // step cannot overflow
+    _y += (int32_t)(((int64_t)x - _y + (1 << (Shift - 1))) >> Shift);
+    return _y;
+  }
+
+  static constexpr float groupDelay() { return (1 << Shift) - 1; }
+
+ private:
+  int32_t _y = 0;
+  bool _primed = false;
+};
+
+// Averages blocks of factor samples and smooths the block means with a single
+// pole IIR over 2^shift blocks. Emits one value per block, so 80 SPS in with a
+// factor of 8 comes out at 10 Hz. Both parameters are runtime settings as this
+// only runs once per block and never on the control path.
+class Decimator {
+ public:
+  void configure(uint8_t factor, uint8_t shift) {
+    _factor = factor > 0 ? factor : 1;
+    _shift = shift < 16 ? shift : 15;
+    reset();
+  }
+
+  void reset() {
+    _sum = 0;
+    _count = 0;
+    _primed = false;
+  }
+
+  // Returns true when a new output value is available
+  bool update(int32_t x) {
+    _sum += x;
+    if (++_count < _factor) {
+      return false;
+    }
+    int32_t mean = (int32_t)(_sum / _factor);
+    _sum = 0;
+    _count = 0;
+    if (!_primed || _shift == 0) {
+      _y = mean;
+      _primed = true;
+    } else {
+      _y += (int32_t)(((int64_t)mean - _y + (1 << (_shift - 1))) >> _shift);
+    }
+    return true;
+  }
+
+  int32_t value() const { return _y; }
+  bool isPrimed() const { return _primed; }
+
+  // Delay in input samples
+  float groupDelay() const {
+    return (_factor - 1) / 2.0f + _factor * ((1 << _shift) - 1);
+  }
+
+ private:
+  int64_t _sum = 0;
+  int32_t _y = 0;
+  uint8_t _factor = 1;
+  uint8_t _shift = 0;
+  uint8_t _count = 0;
+  bool _primed = false;
+};
+
+// Runtime handle for one of the specializations above
+class RawFilter {
+ public:
+  virtual ~RawFilter() {}
+  virtual void reset() = 0;
+  virtual int32_t update(int32_t x) = 0;
+  virtual float groupDelay() const = 0;
+};
+
+template <typename Filter>
+class RawFilterAdapter : public RawFilter {
+ public:
+  void reset() override { _filter.reset(); }
+  int32_t update(int32_t x) override { return _filter.update(x); }
+  float groupDelay() const override { return Filter::groupDelay(); }
+
+ private:
+  Filter _filter;
+};
+
+enum FilterType : uint8_t {
+  MOVING_AVERAGE = 0,
+  CASCADED_BOXCAR,
+  IIR,
+  FILTER_TYPE_MAX,
+};
+
+// Large enough for every specialization selectFilter() can return
+constexpr size_t FILTER_STORAGE_SIZE = 256;
+
+// Map the read_samples setting to one of the specializations and construct it
+// in storage (FILTER_STORAGE_SIZE bytes, no heap). Sizes that are not in the
+// table are rounded down to the next supported one.
+RawFilter *selectFilter(FilterType type, uint8_t samples, void *storage);
+
+}  // namespace scalefilter
+
+// Raw counts in, filtered Q format counts out
+class ScaleFilter {
+ public:
+  ScaleFilter();
+
+  void configure(uint8_t samples, scalefilter::FilterType type);
+  void reset();
+
+  // raw: one conversion in counts. Returns the filtered value in Q format.
+  int32_t update(int32_t raw);
+
+  // Filter delay in samples
+  float getGroupDelay() const;
+
+ private:
+  alignas(8) uint8_t _storage[scalefilter::FILTER_STORAGE_SIZE];
+  scalefilter::RawFilter *_filter;
+};
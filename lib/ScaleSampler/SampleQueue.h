@@ -0,0 +1,56 @@
+#pragma once
+#include <stddef.h>
+
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring buffer.
+// Exactly one task may push and exactly one task may pop. The capacity must be
+// a power of two so the indices can wrap with a mask.
+template <typename T, size_t N>
+class SampleQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0,
+                "SampleQueue capacity must be a power of two");
+
+ public:
+  // Producer side. Returns false (and drops the item) if the queue is full.
+  bool push(const T &item) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    if (head - tail >= N) {
+      return false;
+    }
+    _items[head & (N - 1)] = item;
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false if there is nothing to pop.
+  bool pop(T &item) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_acquire);
+    if (tail == head) {
+      return false;
+    }
+    item = _items[tail & (N - 1)];
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Discards everything that is currently queued.
+  void clear() {
+    _tail.store(_head.load(std::memory_order_acquire),
+                std::memory_order_release);
+  }
+
+  size_t size() const {
+    return _head.load(std::memory_order_acquire) -
+           _tail.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return N; }
+
+ private:
+  T _items[N];
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+};
@@ -0,0 +1,185 @@
+#include "ScaleSampler.h"
+
+#include <math.h>
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+ScaleSampler::ScaleSampler(ADS1232 &scale)
+    : _scale(scale),
+      _mutex(nullptr),
+      _lockDepth(0),
+      _task(nullptr),
+      _starter(nullptr),
+      _dropped(0),
+      _sequence(0),
+      _consumer(nullptr),
+      _calibrationFactor(1.0f),
+      _zero(0),
+      _zeroRequested(true),
+      _pendingZero(0),
+      _zeroPending(false),
+      _drdyPin(-1),
+      _drdyTimestampUs(0),
+      _drdyMux(portMUX_INITIALIZER_UNLOCKED) {}
+
+void ScaleSampler::begin(int drdyPin, BaseType_t core, UBaseType_t priority) {
+  if (_task) {
+    return;
+  }
+  _drdyPin = drdyPin;
+  _mutex = xSemaphoreCreateRecursiveMutex();
+  _starter = xTaskGetCurrentTaskHandle();
+  xTaskCreatePinnedToCore(&ScaleSampler::taskEntry, "scale", 4096, this,
+                          priority, &_task, core);
+  // until run() has claimed the GPIO interrupt for its core
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+void ScaleSampler::lock() {
+  if (_mutex) {
+    xSemaphoreTakeRecursive(_mutex, portMAX_DELAY);
+    // the caller is going to clock DOUT, which would look like DRDY edges
+    if (_lockDepth++ == 0) {
+      setDrdyInterruptEnabled(false);
+    }
+  }
+}
+
+void ScaleSampler::unlock() {
+  if (_mutex) {
+    // only the outermost unlock re-arms DRDY, a nested section ending must
+    // not let edges in while the outer one still clocks DOUT
+    if (--_lockDepth == 0) {
+      setDrdyInterruptEnabled(true);
+    }
+    xSemaphoreGiveRecursive(_mutex);
+  }
+}
+
+void ScaleSampler::setZero(float rawCounts) {
+  _pendingZero.store(lrintf(rawCounts * (1 << scalefilter::FRAC_BITS)));
+  _zeroPending.store(true);
+}
+
+bool ScaleSampler::waitForSample(uint32_t timeoutMs) {
+  _consumer.store(xTaskGetCurrentTaskHandle());
+  // a sample pushed after this check leaves a pending notification behind
+  if (_queue.size() > 0) {
+    return true;
+  }
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(timeoutMs));
+  return _queue.size() > 0;
+}
+
+void ScaleSampler::configure(uint8_t samples, scalefilter::FilterType type,
+                             float calibrationFactor) {
+  lock();
+  _filter.configure(samples, type);
+  _calibrationFactor = calibrationFactor;
+  unlock();
+}
+void ScaleSampler::configureDisplay(uint8_t decimation, uint8_t smoothing) {
+  lock();
+  _decimator.configure(decimation, smoothing);
+  unlock();
+}
+
+void ScaleSampler::setDrdyInterruptEnabled(bool enabled) {
+  if (_drdyPin < 0) {
+    return;
+  }
+  if (enabled) {
+    gpio_intr_enable((gpio_num_t)_drdyPin);
+  } else {
+    gpio_intr_disable((gpio_num_t)_drdyPin);
+  }
+}
+
+void ScaleSampler::taskEntry(void *arg) {
+  static_cast<ScaleSampler *>(arg)->run();
+}
+
+void IRAM_ATTR ScaleSampler::onDataReady(void *arg) {
+  auto *self = static_cast<ScaleSampler *>(arg);
+  int64_t now = esp_timer_get_time();
+
+  portENTER_CRITICAL_ISR(&self->_drdyMux);
+  self->_drdyTimestampUs = now;
+  portEXIT_CRITICAL_ISR(&self->_drdyMux);
+
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(self->_task, &woken);
+  if (woken) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+void ScaleSampler::run() {
+  if (_drdyPin >= 0) {
+    // The GPIO ISR service is pinned to the core of the task that installs
+    // it and runs the handlers of all pins there. Installed from this task,
+    // before begin() returns and the buttons are attached from core 1, it is
+    // pinned to the acquisition core. IRAM, like attachInterrupt() asks for,
+    // so its later calls find it installed with the same flags.
+    gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    attachInterruptArg(digitalPinToInterrupt(_drdyPin),
+                       &ScaleSampler::onDataReady, this, FALLING);
+  }
+  xTaskNotifyGive(_starter);
+
+  for (;;) {
+    bool edge = false;
+    if (_drdyPin >= 0) {
+      edge = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DRDY_TIMEOUT_MS)) > 0;
+    }
+
+    ScaleSample sample;
+    bool ready = false;
+
+    // reading the data clocks DOUT, mask those edges
+    lock();
+    if (_scale.readADCIfReady()) {
+      if (edge) {
+        portENTER_CRITICAL(&_drdyMux);
+        sample.timestamp_us = _drdyTimestampUs;
+        portEXIT_CRITICAL(&_drdyMux);
+      } else {
+        sample.timestamp_us = esp_timer_get_time();
+      }
+      sample.sequence = ++_sequence;
+      sample.raw = _scale.getRaw(sample.stable);
+      sample.filtered = _filter.update(sample.raw);
+      if (_zeroRequested.exchange(false)) {
+        _zero = sample.filtered;
+      }
+      if (_zeroPending.exchange(false)) {
+        _zero = _pendingZero.load();
+      }
+      sample.grams =
+          scalefilter::fromQ(sample.filtered - _zero) * _calibrationFactor;
+      // the zero is applied on the way out, a new tare shows up right away
+      sample.display_update = _decimator.update(scalefilter::toQ(sample.raw));
+      sample.display_grams =
+          _decimator.isPrimed()
+              ? scalefilter::fromQ(_decimator.value() - _zero) *
+                    _calibrationFactor
+              : sample.grams;
+      ready = true;
+    }
+    unlock();
+
+    if (ready) {
+      if (!_queue.push(sample)) {
+        _dropped.fetch_add(1);
+      }
+      TaskHandle_t consumer = _consumer.load();
+      if (consumer) {
+        xTaskNotifyGive(consumer);
+      }
+    } else if (_drdyPin < 0) {
+      // at 80 SPS a conversion is ready every 12.5 ms, one tick is plenty
+      vTaskDelay(1);
+    }
+  }
+}
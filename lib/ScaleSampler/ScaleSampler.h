@@ -0,0 +1,138 @@
+#pragma once
+#include <ADS1232.h>
+#include <Arduino.h>
+
+#include <ScaleFilter.h>
+
+#include <atomic>
+
+#include "SampleQueue.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+// One ADS1232 conversion as seen by the acquisition task.
+struct ScaleSample {
+  // counts every conversion from 1, a gap means samples were lost
+  uint32_t sequence = 0;
+  int64_t timestamp_us = 0;  // esp_timer time of the DRDY edge (or the read)
+  int32_t raw = 0;           // single raw conversion, not averaged
+  int32_t filtered = 0;      // filtered counts in ScaleFilter Q format
+  float grams = 0.0f;        // filtered and tared value
+  bool stable = false;
+  // decimated and smoothed grams for display and websockets, held between
+  // updates of the slow stream
+  float display_grams = 0.0f;
+  bool display_update = false;  // display_grams changed with this sample
+};
+
+// Reads every ADS1232 conversion from a dedicated FreeRTOS task and hands the
+// samples to the main loop through a lock-free queue. This keeps slow display
+// frames and websocket traffic on the loop() core from delaying or dropping
+// conversions.
+//
+// Each conversion runs through a ScaleFilter on the acquisition core and is
+// converted to grams with the calibration factor and the zero point. That
+// full-rate stream is meant for control and should be filtered lightly.
+// Independently the raw conversions are decimated and smoothed into a slow
+// stream for the display and the websockets, which can afford the delay.
+//
+// Two acquisition modes are supported:
+//  * polling: the task checks the ADC once per tick and stamps the sample with
+//    the time it was read
+//  * DRDY interrupt: the ADS1232 pulls DOUT low when a conversion is ready.
+//    The falling edge is timestamped in the ISR with esp_timer and wakes the
+//    task, so the sample carries the time the conversion actually finished.
+//
+// Every sample carries a sequence number and each push notifies the task
+// waiting in waitForSample(), so the consumer can sleep until there is a new
+// conversion instead of spinning on the last one.
+//
+// The ADS1232 object must only be touched by the acquisition task once
+// begin() was called. Everything else (setup, tare) has to go through
+// lock() / unlock().
+class ScaleSampler {
+ public:
+  static constexpr size_t QUEUE_SIZE = 64;
+  // wake up even if a DRDY edge was missed
+  static constexpr uint32_t DRDY_TIMEOUT_MS = 200;
+
+  explicit ScaleSampler(ADS1232 &scale);
+
+  // Start the acquisition task. Pass the DOUT pin as drdyPin to use the DRDY
+  // interrupt, or -1 to poll. loop() runs on core 1, so by default the task
+  // is pinned to core 0. Returns once the task installed the GPIO ISR
+  // service, so interrupts attached afterwards are serviced on that core as
+  // well; begin() has to come before any attachInterrupt().
+  void begin(int drdyPin = -1, BaseType_t core = 0, UBaseType_t priority = 10);
+
+  // Take / release exclusive access to the ADS1232 from another task.
+  // Recursive, so it may be nested. DRDY stays masked until the outermost
+  // unlock().
+  void lock();
+  void unlock();
+
+  // Select the filter and the counts to grams factor
+  void configure(uint8_t samples, scalefilter::FilterType type,
+                 float calibrationFactor);
+
+  // Decimation factor and IIR shift of the display stream
+  void configureDisplay(uint8_t decimation, uint8_t smoothing);
+
+  // Use the filtered value of the next conversion as zero point
+  void zero() { _zeroRequested = true; }
+
+  // Use rawCounts (e.g. a tare mean) as zero point from the next conversion on
+  void setZero(float rawCounts);
+
+  // Filter delay in samples
+  float getFilterDelay() const { return _filter.getGroupDelay(); }
+
+  // Display stream delay in samples
+  float getDisplayDelay() const { return _decimator.groupDelay(); }
+
+  // Consumer side: pop the oldest queued sample
+  bool pop(ScaleSample &sample) { return _queue.pop(sample); }
+
+  // Consumer side: block the calling task until a sample is queued or
+  // timeoutMs passed. Returns false on timeout. Only one task may wait.
+  bool waitForSample(uint32_t timeoutMs);
+
+  // Consumer side: drop all queued samples (e.g. after a tare)
+  void flush() { _queue.clear(); }
+
+  // Samples that were lost because the consumer did not keep up
+  uint32_t getDropped() const { return _dropped.load(); }
+
+ private:
+  static void taskEntry(void *arg);
+  static void IRAM_ATTR onDataReady(void *arg);
+  void run();
+  void setDrdyInterruptEnabled(bool enabled);
+
+  ADS1232 &_scale;
+  SampleQueue<ScaleSample, QUEUE_SIZE> _queue;
+  SemaphoreHandle_t _mutex;
+  // nesting of lock(), only touched while holding _mutex
+  uint32_t _lockDepth;
+  TaskHandle_t _task;
+  // task that called begin(), waiting for the task to start
+  TaskHandle_t _starter;
+  std::atomic<uint32_t> _dropped;
+  uint32_t _sequence;
+  // task to notify on a new sample, set by waitForSample()
+  std::atomic<TaskHandle_t> _consumer;
+
+  ScaleFilter _filter;
+  scalefilter::Decimator _decimator;
+  float _calibrationFactor;
+  int32_t _zero;
+  std::atomic<bool> _zeroRequested;
+  std::atomic<int32_t> _pendingZero;
+  std::atomic<bool> _zeroPending;
+
+  int _drdyPin;
+  // written by the ISR, guarded by _drdyMux
+  int64_t _drdyTimestampUs;
+  portMUX_TYPE _drdyMux;
+};
@@ -0,0 +1,82 @@
+#include "ShotTimer.h"
+
+#include <math.h>
+
+// a shot pours at one to three g/s, start without a strong opinion
+static const float INITIAL_RATE = 0.0f;
+static const float INITIAL_RATE_STD = 2.0f;
+
+ShotTimer::ShotTimer() { reset(); }
+
+void ShotTimer::reset() {
+  _flow.stop();
+  _phase = WAITING;
+  _startUs = 0;
+  _lastUs = 0;
+  _lastDripUs = 0;
+  _weight = 0.0f;
+  _summary = {};
+}
+
+ShotTimer::Phase ShotTimer::update(float grams, int64_t timestampUs) {
+  switch (_phase) {
+    case WAITING:
+      if (grams < START_G) {
+        break;
+      }
+      _phase = POURING;
+      _startUs = timestampUs;
+      _lastDripUs = timestampUs;
+      _flow.reset(grams, INITIAL_RATE, INITIAL_RATE_STD, timestampUs);
+      // fall through
+    case POURING:
+      _flow.update(grams, timestampUs);
+      _lastUs = timestampUs;
+      // lifting the cup at the end must not take the shot with it
+      _weight = fmaxf(_weight, grams);
+      if (_flow.getRate() > _summary.peakFlow) {
+        _summary.peakFlow = _flow.getRate();
+      }
+      if (_flow.getRate() >= END_FLOW) {
+        _lastDripUs = timestampUs;
+      } else if (timestampUs - _lastDripUs > END_HOLD_US) {
+        finish();
+      }
+      break;
+    case DONE:
+      break;
+  }
+  return _phase;
+}
+
+void ShotTimer::stop() {
+  if (_phase == POURING) {
+    // stopped by hand, the shot ran up to now
+    _lastDripUs = _lastUs;
+    finish();
+  }
+}
+
+void ShotTimer::finish() {
+  _phase = DONE;
+  _flow.stop();
+  _summary.seconds = (_lastDripUs - _startUs) / 1e6f;
+  _summary.weight = _weight;
+  _summary.averageFlow =
+      _summary.seconds > 0.0f ? _summary.weight / _summary.seconds : 0.0f;
+}
+
+float ShotTimer::getSeconds() const {
+  switch (_phase) {
+    case POURING:
+      return (_lastUs - _startUs) / 1e6f;
+    case DONE:
+      return _summary.seconds;
+    default:
+      return 0.0f;
+  }
+}
+
+float ShotTimer::getFlow() const {
+  return _phase == POURING ? _flow.getRate() : 0.0f;
+}
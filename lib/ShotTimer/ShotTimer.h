@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+
+#include <FlowEstimator.h>
+
+// Times an espresso shot on a tared cup and tracks its flow.
+//
+// The shot starts with the first drip, the first reading above START_G. From
+// then on every sample goes through a FlowEstimator, so the g/s are smoothed
+// at the full sample rate without a window delay. The shot is over once the
+// flow stayed below END_FLOW for END_HOLD_US, or when stop() is called. The
+// time of the shot runs up to the last drip, not to the end of the hold.
+class ShotTimer {
+ public:
+  enum Phase : uint8_t {
+    WAITING = 0,  // for the first drip
+    POURING,
+    DONE,
+  };
+
+  struct Summary {
+    float seconds;      // first to last drip
+    float weight;       // in the cup
+    float averageFlow;  // weight / seconds
+    float peakFlow;
+  };
+
+  static constexpr float START_G = 0.3f;
+  static constexpr float END_FLOW = 0.2f;
+  static constexpr int64_t END_HOLD_US = 3000000;
+
+  ShotTimer();
+
+  // Wait for the next shot
+  void reset();
+
+  // Once per sample of the tared cup
+  Phase update(float grams, int64_t timestampUs);
+
+  // End the shot by hand
+  void stop();
+
+  Phase getPhase() const { return _phase; }
+  // seconds since the first drip, frozen once the shot is done
+  float getSeconds() const;
+  float getFlow() const;
+  const Summary &getSummary() const { return _summary; }
+
+ private:
+  void finish();
+
+  FlowEstimator _flow;
+  Phase _phase;
+  int64_t _startUs;
+  int64_t _lastUs;
+  int64_t _lastDripUs;  // last sample the flow was above END_FLOW
+  float _weight;  // highest reading since the first drip
+  Summary _summary;
+};
@@ -0,0 +1,117 @@
+#include "StabilityDetector.h"
+
+#include <math.h>
+
+StabilityDetector::StabilityDetector()
+    : _window(16),
+      _gramsPerCount(1.0f),
+      _maxStdDev(0.02f),
+      _maxSlope(0.05f) {
+  reset();
+}
+
+void StabilityDetector::configure(uint8_t window, float gramsPerCount,
+                                  float maxStdDev, float maxSlope) {
+  if (window < 2) window = 2;
+  if (window > MAX_WINDOW) window = MAX_WINDOW;
+  _window = window;
+  _gramsPerCount = fabsf(gramsPerCount);
+  _maxStdDev = maxStdDev;
+  _maxSlope = maxSlope;
+  reset();
+}
+
+void StabilityDetector::reset() {
+  _reference = 0;
+  _head = 0;
+  _count = 0;
+  _sum = 0;
+  _sumSq = 0;
+  _sumXY = 0;
+  _stableSinceUs = 0;
+}
+
+void StabilityDetector::update(int32_t raw, int64_t timestampUs) {
+  if (_count == 0) {
+    _reference = raw;
+  }
+  int32_t x = raw - _reference;
+
+  if (_count < _window) {
+    // growing window
+    ++_count;
+    _sumXY += (int64_t)(_count - 1) * x;
+    _sum += x;
+    _sumSq += (int64_t)x * x;
+  } else {
+    // sliding window: replace the oldest value
+    int32_t old = _values[_head];
+    // every value moves one position towards the front, the oldest drops out
+    // at position 0 and x enters at position N - 1
+    _sumXY += -(_sum - old) + (int64_t)(_window - 1) * x;
+    _sum += x - old;
+    _sumSq += (int64_t)x * x - (int64_t)old * old;
+  }
+  _values[_head] = x;
+  _timestamps[_head] = timestampUs;
+  _head = (_head + 1) % _window;
+
+  bool stable = isFull() && getStdDev() <= _maxStdDev &&
+                fabsf(getSlope()) <= _maxSlope;
+  if (!stable) {
+    _stableSinceUs = 0;
+  } else if (_stableSinceUs == 0) {
+    _stableSinceUs = timestampUs;
+  }
+}
+
+float StabilityDetector::getMean() const {
+  if (_count == 0) {
+    return _reference;
+  }
+  return _reference + (float)((double)_sum / _count);
+}
+
+float StabilityDetector::getStdDev() const {
+  if (_count < 2) {
+    return INFINITY;
+  }
+  // n * sum(x^2) - sum(x)^2 is exact and never negative
+  int64_t scaled = (int64_t)_count * _sumSq - _sum * _sum;
+  double variance = (double)scaled / ((double)_count * (_count - 1));
+  return sqrtf((float)variance) * _gramsPerCount;
+}
+
+float StabilityDetector::getSlope() const {
+  if (_count < 2) {
+    return INFINITY;
+  }
+  // least squares slope per sample over x = 0 .. n-1
+  float n = _count;
+  float sumX = n * (n - 1) / 2;
+  float sumXX = (n - 1) * n * (2 * n - 1) / 6;
+  float perSample = (n * (float)_sumXY - sumX * (float)_sum) /
+                    (n * sumXX - sumX * sumX);
+
+  // _head points at the oldest sample once the window is full
+  uint8_t oldest = isFull() ? _head : 0;
+  uint8_t newest = (_head + _window - 1) % _window;
+  float seconds = (_timestamps[newest] - _timestamps[oldest]) / 1000000.0f;
+  if (!(seconds > 0)) {
+    return INFINITY;
+  }
+  return perSample * (n - 1) / seconds * _gramsPerCount;
+}
+
+float StabilityDetector::getConfidence() const {
+  if (!isFull()) {
+    return 0.0f;
+  }
+  float stdRatio = getStdDev() / _maxStdDev;
+  float slopeRatio = fabsf(getSlope()) / _maxSlope;
+  float worst = stdRatio > slopeRatio ? stdRatio : slopeRatio;
+  if (worst >= 1.0f) {
+    return 0.0f;
+  }
+  return 1.0f - worst;
+}
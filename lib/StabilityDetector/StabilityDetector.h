@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+
+// Streaming stability detection over a sliding window of raw conversions.
+//
+// Mean, variance and the slope of a least squares fit are computed from exact
+// integer running sums over the window, O(1) per sample. Nothing is rounded
+// as samples enter and leave, so a large step can't leave a residue behind.
+// Values are kept relative to the first sample after reset(), which keeps
+// n * sum(x^2) within int64 even for full scale swings.
+//
+// The signal counts as stable once the window is full, its standard deviation
+// is below maxStdDev and the absolute slope is below maxSlope.
+class StabilityDetector {
+ public:
+  static constexpr uint8_t MAX_WINDOW = 64;
+
+  StabilityDetector();
+
+  // gramsPerCount converts raw counts, the thresholds are in grams and g/s
+  void configure(uint8_t window, float gramsPerCount, float maxStdDev,
+                 float maxSlope);
+  void reset();
+
+  void update(int32_t raw, int64_t timestampUs);
+
+  bool isStable() const { return _stableSinceUs != 0; }
+  // Time of the first sample of the current stable stretch, 0 if not stable
+  int64_t getStableSinceUs() const { return _stableSinceUs; }
+  // 0 while the window fills or the thresholds are exceeded, approaching 1
+  // the further the signal is below both thresholds
+  float getConfidence() const;
+
+  // Window statistics, in grams and g/s
+  float getStdDev() const;
+  float getSlope() const;
+  // Window mean in raw counts
+  float getMean() const;
+  bool isFull() const { return _count == _window; }
+
+ private:
+  uint8_t _window;
+  float _gramsPerCount;
+  float _maxStdDev;
+  float _maxSlope;
+
+  int32_t _reference;
+  int32_t _values[MAX_WINDOW];
+  int64_t _timestamps[MAX_WINDOW];
+  uint8_t _head;   // next slot to write
+  uint8_t _count;
+
+  // sums of the values and their squares, and of position * value for the
+  // slope with x the position in the window
+  int64_t _sum;
+  int64_t _sumSq;
+  int64_t _sumXY;
+
+  int64_t _stableSinceUs;
+};
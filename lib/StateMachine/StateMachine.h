@@ -0,0 +1,178 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+// Table-driven state machine with a FreeRTOS event queue.
+//
+// Events can be posted from any task (post()) or from an ISR (postFromISR()),
+// but they are only processed in dispatch(), on the task that owns the
+// machine. dispatch() handles the queued events in order and then runs the
+// current state, so a transition never races with the code of the state it
+// leaves and no event is lost between two loop iterations.
+//
+// For each event the first row of the transition table that matches the
+// current state and the event type, and whose guard passes, is taken. A row
+// with from == to is an internal transition and only runs its action.
+// Otherwise the exit action of the old state, the row's action and the entry
+// action of the new state run in that order. Events without a matching row
+// are ignored.
+//
+// States raise their own events (done, timeout) with raise(). Those are
+// stamped with the state that raised them and are dropped if the machine has
+// left that state by the time they are dispatched, e.g. a confirm timeout
+// racing with the confirming button press.
+//
+// Event must have a `type` member, the table is matched on it.
+template <typename State, typename Event, size_t StateCount>
+class StateMachine {
+ public:
+  typedef decltype(Event::type) EventType;
+  typedef void (*Action)();
+  typedef bool (*Guard)(const Event &event);
+  typedef void (*EventAction)(const Event &event);
+
+  struct StateInfo {
+    const char *name;
+    Action enter;  // may be nullptr
+    Action run;    // called once per dispatch() while in the state
+    Action exit;   // may be nullptr
+  };
+
+  struct Transition {
+    State from;
+    EventType type;
+    Guard guard;         // nullptr: always
+    EventAction action;  // nullptr: none
+    State to;
+  };
+
+  StateMachine(const StateInfo (&states)[StateCount],
+               const Transition *transitions, size_t transitionCount)
+      : _states(states),
+        _transitions(transitions),
+        _transitionCount(transitionCount),
+        _queue(nullptr),
+        _queueLength(0),
+        _state(State()),
+        _dropped(0) {}
+
+  // Create the queue and enter the initial state
+  bool begin(State initial, size_t queueLength = 16) {
+    _queue = xQueueCreate(queueLength, sizeof(Queued));
+    if (!_queue) {
+      return false;
+    }
+    _queueLength = queueLength;
+    _state = initial;
+    if (_states[_state].enter) {
+      _states[_state].enter();
+    }
+    return true;
+  }
+
+  // From any task, interpreted in the state current at dispatch time
+  bool post(const Event &event) { return send(event, false); }
+
+  // From an ISR
+  bool IRAM_ATTR postFromISR(const Event &event) {
+    if (!_queue) {
+      return false;
+    }
+    Queued queued = {event, State(), false};
+    BaseType_t woken = pdFALSE;
+    if (xQueueSendFromISR(_queue, &queued, &woken) != pdTRUE) {
+      _dropped.fetch_add(1);
+      return false;
+    }
+    if (woken) {
+      portYIELD_FROM_ISR();
+    }
+    return true;
+  }
+
+  // From the state code, only valid while still in the current state
+  bool raise(const Event &event) { return send(event, true); }
+
+  // Process the queued events and run the current state
+  void dispatch() {
+    Queued queued;
+    // bounded, an action raising events can't keep us here forever
+    for (size_t i = 0;
+         i < _queueLength && xQueueReceive(_queue, &queued, 0) == pdTRUE;
+         ++i) {
+      if (queued.stamped && queued.source != _state) {
+        continue;
+      }
+      handle(queued.event);
+    }
+    _states[_state].run();
+  }
+
+  State getState() const { return _state; }
+  const char *getStateName() const { return _states[_state].name; }
+
+  // Events lost because the queue was full
+  uint32_t getDropped() const { return _dropped.load(); }
+
+ private:
+  struct Queued {
+    Event event;
+    State source;
+    bool stamped;
+  };
+
+  bool send(const Event &event, bool stamped) {
+    if (!_queue) {
+      return false;
+    }
+    Queued queued = {event, _state, stamped};
+    if (xQueueSend(_queue, &queued, 0) != pdTRUE) {
+      _dropped.fetch_add(1);
+      return false;
+    }
+    return true;
+  }
+
+  void handle(const Event &event) {
+    for (size_t i = 0; i < _transitionCount; ++i) {
+      const Transition &t = _transitions[i];
+      if (t.from != _state || t.type != event.type) {
+        continue;
+      }
+      if (t.guard && !t.guard(event)) {
+        continue;
+      }
+      if (t.to == _state) {
+        if (t.action) {
+          t.action(event);
+        }
+        return;
+      }
+      if (_states[_state].exit) {
+        _states[_state].exit();
+      }
+      if (t.action) {
+        t.action(event);
+      }
+      _state = t.to;
+      if (_states[_state].enter) {
+        _states[_state].enter();
+      }
+      return;
+    }
+  }
+
+  const StateInfo (&_states)[StateCount];
+  const Transition *_transitions;
+  size_t _transitionCount;
+  QueueHandle_t _queue;
+  size_t _queueLength;
+  State _state;
+  std::atomic<uint32_t> _dropped;
+};
@@ -0,0 +1,118 @@
+#include "TareEngine.h"
+
+#include <math.h>
+
+// a sample further than this many max std devs from the mean restarts
+static const float OUTLIER_FACTOR = 4.0f;
+
+TareEngine::TareEngine()
+    : _gramsPerCount(1.0f),
+      _maxStdDev(0.03f),
+      _targetError(0.005f),
+      _minSamples(8),
+      _running(false),
+      _continuous(false),
+      _done(false),
+      _reference(0),
+      _count(0),
+      _mean(0.0f),
+      _m2(0.0f) {}
+
+void TareEngine::configure(float gramsPerCount, float maxStdDev,
+                           float targetError, uint16_t minSamples) {
+  _gramsPerCount = fabsf(gramsPerCount);
+  _maxStdDev = maxStdDev;
+  _targetError = targetError;
+  _minSamples = minSamples < 2 ? 2 : minSamples;
+}
+
+void TareEngine::start(bool continuous) {
+  _running = true;
+  _continuous = continuous;
+  _done = false;
+  _count = 0;
+}
+
+void TareEngine::stop() {
+  _running = false;
+  _done = false;
+  _count = 0;
+}
+
+void TareEngine::restart(int32_t raw) {
+  _done = false;
+  _reference = raw;
+  _count = 1;
+  _mean = 0.0f;
+  _m2 = 0.0f;
+}
+
+bool TareEngine::update(int32_t raw) {
+  if (!_running) {
+    return _done;
+  }
+
+  if (_count == 0) {
+    restart(raw);
+    return false;
+  }
+
+  float x = raw - _reference;
+  float deviation = fabsf(x - _mean) * _gramsPerCount;
+  if (deviation > OUTLIER_FACTOR * _maxStdDev) {
+    restart(raw);
+    return false;
+  }
+
+  float delta = x - _mean;
+  if (!_continuous || _count < CONTINUOUS_SAMPLES) {
+    // Welford
+    if (_count < UINT16_MAX) {
+      ++_count;
+    }
+    _mean += delta / _count;
+    _m2 += delta * (x - _mean);
+  } else {
+    // exponentially weighted with the same memory, follows slow drift
+    float alpha = 1.0f / _count;
+    _mean += alpha * delta;
+    float variance = _m2 / (_count - 1);
+    variance = (1 - alpha) * (variance + alpha * delta * delta);
+    _m2 = variance * (_count - 1);
+  }
+
+  _done = _count >= _minSamples && getStdDev() <= _maxStdDev &&
+          getStandardError() <= _targetError;
+  if (_done && !_continuous) {
+    _running = false;
+  }
+  return _done;
+}
+
+float TareEngine::getStdDev() const {
+  if (_count < 2) {
+    return INFINITY;
+  }
+  return sqrtf(_m2 / (_count - 1)) * _gramsPerCount;
+}
+
+float TareEngine::getStandardError() const {
+  if (_count < 2) {
+    return INFINITY;
+  }
+  return getStdDev() / sqrtf(_count);
+}
+
+float TareEngine::getProgress() const {
+  if (_done) {
+    return 1.0f;
+  }
+  if (_count < 2) {
+    return 0.0f;
+  }
+  float bySamples = (float)_count / _minSamples;
+  float byError = _targetError / getStandardError();
+  float progress = bySamples < byError ? bySamples : byError;
+  // enough samples with a small error but too noisy is not done either
+  return progress > 0.99f ? 0.99f : progress;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+
+// Incremental tare. Raw conversions are fed one at a time from the main loop
+// instead of blocking until enough samples were collected.
+//
+// The zero point is the running mean of the conversions since start(). The
+// tare completes as soon as at least minSamples were seen and the standard
+// error of the mean dropped below targetError, so the latency is bounded by
+// the noise of the signal rather than by a fixed sample count. A sample that
+// is far off the running mean (cup still being placed, a bump) restarts the
+// accumulation.
+//
+// In continuous mode the engine never finishes. It keeps a running baseline
+// whose memory is limited to the last CONTINUOUS_SAMPLES conversions, and
+// isDone() tells whether that baseline currently meets the tare criteria, so
+// it can be committed the instant it is needed.
+class TareEngine {
+ public:
+  static constexpr uint16_t CONTINUOUS_SAMPLES = 64;
+
+  TareEngine();
+
+  // gramsPerCount converts raw counts, maxStdDev and targetError are in grams
+  void configure(float gramsPerCount, float maxStdDev, float targetError,
+                 uint16_t minSamples);
+
+  void start(bool continuous = false);
+  void stop();
+
+  // Feed one raw conversion. Returns true once the tare is complete.
+  bool update(int32_t raw);
+
+  bool isRunning() const { return _running; }
+  bool isDone() const { return _done; }
+
+  // 0 .. 1, how far along the statistics are
+  float getProgress() const;
+
+  // Zero point in raw counts
+  float getOffset() const { return _reference + _mean; }
+  uint16_t getSampleCount() const { return _count; }
+  // Std dev of the accumulated conversions in grams
+  float getStdDev() const;
+
+ private:
+  void restart(int32_t raw);
+  float getStandardError() const;
+
+  float _gramsPerCount;
+  float _maxStdDev;
+  float _targetError;
+  uint16_t _minSamples;
+
+  bool _running;
+  bool _continuous;
+  bool _done;
+  int32_t _reference;
+  uint16_t _count;
+  float _mean;
+  float _m2;
+};
@@ -60,6 +60,7 @@ const char PROGMEM WebSocketGraph::graph_html[] = R"rawliteral(
         let weightChart;
         let targetDataset;
         let weightDataset;
+        let flowDataset;
         let targetWeight;
 
         function createChart() {
@@ -92,10 +93,21 @@ const char PROGMEM WebSocketGraph::graph_html[] = R"rawliteral(
                 data: [],
             };
 
+            flowDataset = {
+                label: 'Flow',
+                backgroundColor: '#3498db',
+                borderColor: '#3498db',
+                borderWidth: 2,
+                radius: 0,
+                fill: false,
+                yAxisID: 'flow',
+                data: [],
+            };
+
             weightChart = new Chart(ctx, {
                 type: 'line',
                 data: {
-                    datasets: [targetDataset, weightDataset],
+                    datasets: [targetDataset, weightDataset, flowDataset],
                 },
                 options: {
                     responsive: true,
@@ -125,6 +137,22 @@ const char PROGMEM WebSocketGraph::graph_html[] = R"rawliteral(
                                 color: 'white',
                             },
                         },
+                        flow: {
+                            type: 'linear',
+                            position: 'right',
+                            display: 'auto',
+                            title: {
+                                display: true,
+                                text: 'Flow [g/s]',
+                                color: 'white',
+                            },
+                            ticks: {
+                                color: 'white',
+                            },
+                            grid: {
+                                drawOnChartArea: false,
+                            },
+                        },
                     },
                     plugins: {
                         legend: {
@@ -159,6 +187,9 @@ const char PROGMEM WebSocketGraph::graph_html[] = R"rawliteral(
             } else {
                 targetDataset.data.push({ x: data.seconds, y: targetWeight });
                 weightDataset.data.push({ x: data.seconds, y: data.weight });
+                if (data.flow !== undefined) {
+                    flowDataset.data.push({ x: data.seconds, y: data.flow });
+                }
                 weightChart.update();
             }
         };
@@ -180,7 +211,7 @@ const char PROGMEM WebSocketGraph::graph_html[] = R"rawliteral(
 
 WebSocketGraph::WebSocketGraph()
     : _ws("/GraphWebSocket"), _server(nullptr), _lastWeightValue(-1.0f),
-      _lastSecondsValue(-1.0f) {}
+      _lastSecondsValue(-1.0f), _lastShotMillis(0) {}
 
 void WebSocketGraph::begin(AsyncWebServer *server) {
   _server = server;
@@ -232,6 +263,27 @@ void WebSocketGraph::updateGraphData(float seconds, float weight) {
   _ws.textAll(jsonString.c_str());
 }
 
+void WebSocketGraph::updateShotData(float seconds, float weight,
+                                    float flow) {
+  // every sample up to 20 Hz, the shot is short and the flow is the point
+  uint32_t now = millis();
+  if (now - _lastShotMillis < 50)
+    return;
+  _lastShotMillis = now;
+
+  StaticJsonDocument<80> jsonDoc;
+  char s[8], w[8], f[8];
+  sprintf(s, "%1.2f", seconds);
+  sprintf(w, "%1.2f", weight);
+  sprintf(f, "%1.2f", flow);
+  jsonDoc["seconds"] = s;
+  jsonDoc["weight"] = w;
+  jsonDoc["flow"] = f;
+  String jsonString;
+  serializeJson(jsonDoc, jsonString);
+  _ws.textAll(jsonString.c_str());
+}
+
 void WebSocketGraph::finalizeGraph() {
   StaticJsonDocument<20> jsonDoc;
   jsonDoc["finalize"] = true;
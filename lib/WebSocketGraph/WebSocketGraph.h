@@ -12,6 +12,8 @@ public:
   void begin(AsyncWebServer *server);
   void resetGraph(float target_weight);
   void updateGraphData(float seconds, float weight);
+  // espresso shot, weight plus smoothed flow at up to 20 Hz
+  void updateShotData(float seconds, float weight, float flow);
   void finalizeGraph();
 
 private:
@@ -28,4 +30,5 @@ private:
 
   float _lastWeightValue;
   float _lastSecondsValue;
+  uint32_t _lastShotMillis;
 };
\ No newline at end of file
@@ -4,7 +4,8 @@
 
 WebSocketMetrics::WebSocketMetrics()
     : _ws("/MetricsWebSocket"), _server(nullptr), _logger(nullptr),
-      _replayIndex(0), _lastProgressMillis(0) {}
+      _replayIndex(0), _lastProgressMillis(0),
+      _lastShotMillis(0) {}
 
 void WebSocketMetrics::begin(AsyncWebServer *server, const WebSocketLogger *logger) {
   _server = server;
@@ -80,6 +81,19 @@ void WebSocketMetrics::sendTopUp(unsigned long runtimeMillis, float deltaGrams)
   broadcastAndStore(buf);
 }
 
+void WebSocketMetrics::sendDeadTime(float onSeconds, float offSeconds,
+                                    float onEstimate, float offEstimate) {
+  StaticJsonDocument<128> doc;
+  doc["type"] = "deadtime";
+  doc["on_ms"] = onSeconds * 1000.0f;
+  doc["off_ms"] = offSeconds * 1000.0f;
+  doc["on_est_ms"] = onEstimate * 1000.0f;
+  doc["off_est_ms"] = offEstimate * 1000.0f;
+  char buf[160];
+  serializeJson(doc, buf, sizeof(buf));
+  broadcastAndStore(buf);
+}
+
 void WebSocketMetrics::sendFinalize(float seconds, float finalWeight) {
   StaticJsonDocument<64> doc;
   doc["type"] = "finalize";
@@ -90,6 +104,61 @@ void WebSocketMetrics::sendFinalize(float seconds, float finalWeight) {
   broadcastAndStore(buf);
 }
 
+void WebSocketMetrics::sendError(const char *error, float seconds,
+                                 float weight) {
+  StaticJsonDocument<96> doc;
+  doc["type"] = "error";
+  doc["error"] = error;
+  doc["seconds"] = seconds;
+  doc["weight"] = weight;
+  char buf[112];
+  serializeJson(doc, buf, sizeof(buf));
+  broadcastAndStore(buf);
+}
+
+void WebSocketMetrics::sendBatchResult(uint8_t index, uint8_t total,
+                                       float target, float seconds,
+                                       float finalWeight) {
+  StaticJsonDocument<128> doc;
+  doc["type"] = "batch";
+  doc["index"] = index;
+  doc["total"] = total;
+  doc["target"] = target;
+  doc["seconds"] = seconds;
+  doc["weight"] = finalWeight;
+  char buf[144];
+  serializeJson(doc, buf, sizeof(buf));
+  broadcastAndStore(buf);
+}
+
+void WebSocketMetrics::sendShot(float seconds, float weight, float flow) {
+  uint32_t now = millis();
+  if (now - _lastShotMillis < 50) return; // 20 Hz, much finer than progress
+  _lastShotMillis = now;
+  StaticJsonDocument<80> doc;
+  doc["type"] = "shot";
+  doc["seconds"] = seconds;
+  doc["weight"] = weight;
+  doc["flow"] = flow;
+  char buf[96];
+  serializeJson(doc, buf, sizeof(buf));
+  // live only, a replay full of shot samples would push out the results
+  _ws.textAll(buf);
+}
+
+void WebSocketMetrics::sendShotSummary(float seconds, float weight,
+                                       float averageFlow, float peakFlow) {
+  StaticJsonDocument<112> doc;
+  doc["type"] = "shot_summary";
+  doc["seconds"] = seconds;
+  doc["weight"] = weight;
+  doc["average_flow"] = averageFlow;
+  doc["peak_flow"] = peakFlow;
+  char buf[128];
+  serializeJson(doc, buf, sizeof(buf));
+  broadcastAndStore(buf);
+}
+
 uint32_t WebSocketMetrics::getClientCount() const {
   return _ws.count();
 }
@@ -16,7 +16,22 @@ public:
   void sendTarget(float targetWeight);
   void sendProgress(float seconds, float weight); // throttled internally
   void sendTopUp(unsigned long runtimeMillis, float deltaGrams);
+  // measured relay on / off dead times of a session and their estimates
+  void sendDeadTime(float onSeconds, float offSeconds, float onEstimate,
+                    float offEstimate);
   void sendFinalize(float seconds, float finalWeight);
+  // a grind that was aborted, error is a short machine readable code
+  void sendError(const char *error, float seconds, float weight);
+
+  // result of dose index (1 based) of a batch of total doses
+  void sendBatchResult(uint8_t index, uint8_t total, float target,
+                       float seconds, float finalWeight);
+
+  // espresso shot as it pours, up to 20 Hz and not replayed
+  void sendShot(float seconds, float weight, float flow);
+  // extraction summary of a finished shot
+  void sendShotSummary(float seconds, float weight, float averageFlow,
+                       float peakFlow);
 
   uint32_t getClientCount() const;
 
@@ -35,4 +50,5 @@ private:
   uint8_t _replayIndex;
 
   uint32_t _lastProgressMillis;
+  uint32_t _lastShotMillis;
 };
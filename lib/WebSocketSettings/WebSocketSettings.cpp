@@ -2,6 +2,7 @@
 #include "WebSocketSettings.h"
 
 #include <ESPAsyncWebServer.h>
+#include <stddef.h>
 
 #include "ArduinoJson.h"
 #include "WebSocketLogger.h"
@@ -191,6 +192,7 @@ const char PROGMEM config_html[] = R"rawliteral(
             setActiveButton('.speedButton', settings['speed']);
             setActiveButton('.readSamplesButton', settings['read_samples']);
             setActiveButton('.gainButton', settings['gain']);
+            setActiveButton('.filterTypeButton', settings['filter_type']);
 
             setInputValue('calibration_factor', settings['calibration_factor']);
             setInputValue('target_dose_single', settings['target_dose_single']);
@@ -212,6 +214,28 @@ const char PROGMEM config_html[] = R"rawliteral(
             setInputValue('min_topup_runtime_ms', settings['min_topup_runtime_ms']);
             setInputValue('min_topup_interval_ms', settings['min_topup_interval_ms']);
             setInputValue('screensaver_timeout_s', settings['screensaver_timeout_s']);
+            setInputValue('rate_max_std', settings['rate_max_std']);
+            setInputValue('stability_window', settings['stability_window']);
+            setInputValue('stability_max_std', settings['stability_max_std']);
+            setInputValue('stability_max_slope', settings['stability_max_slope']);
+            setInputValue('stability_min_confidence', settings['stability_min_confidence']);
+            setInputValue('tare_target_error', settings['tare_target_error']);
+            setInputValue('tare_min_samples', settings['tare_min_samples']);
+            setInputValue('display_decimation', settings['display_decimation']);
+            setInputValue('display_smoothing', settings['display_smoothing']);
+            setInputValue('zero_tracking_band', settings['zero_tracking_band']);
+            setInputValue('zero_tracking_tau_s', settings['zero_tracking_tau_s']);
+            setInputValue('auto_tune_margins', settings['auto_tune_margins']);
+            setInputValue('approach_fraction', settings['approach_fraction']);
+            setInputValue('approach_tolerance', settings['approach_tolerance']);
+            setInputValue('approach_budget_ms', settings['approach_budget_ms']);
+            setInputValue('anomaly_no_flow_ms', settings['anomaly_no_flow_ms']);
+            setInputValue('anomaly_stall_ms', settings['anomaly_stall_ms']);
+            setInputValue('cup_removal_step', settings['cup_removal_step']);
+            setInputValue('auto_start', settings['auto_start']);
+            setInputValue('batch_cups', settings['batch_cups']);
+            setInputValue('espresso_yield', settings['espresso_yield']);
+            setInputValue('profile', settings['profile']);
         }
 
         function setInputValue(id, value) {
@@ -235,6 +259,7 @@ const char PROGMEM config_html[] = R"rawliteral(
             if (key === 'speed') setActiveButton('.speedButton', value);
             if (key === 'read_samples') setActiveButton('.readSamplesButton', value);
             if (key === 'gain') setActiveButton('.gainButton', value);
+            if (key === 'filter_type') setActiveButton('.filterTypeButton', value);
         }
 
         function saveSettings() {
@@ -293,6 +318,14 @@ const char PROGMEM config_html[] = R"rawliteral(
             <button class="button readSamplesButton" onclick="updateValue('read_samples', 48)" data-value="48">48</button>
         </div>
     </div>
+    <div class="setting-container">
+        <div class="description">Filter</div>
+        <div class="button-group">
+            <button class="button filterTypeButton" onclick="updateValue('filter_type', 0)" data-value="0">AVG</button>
+            <button class="button filterTypeButton" onclick="updateValue('filter_type', 1)" data-value="1">BOX</button>
+            <button class="button filterTypeButton" onclick="updateValue('filter_type', 2)" data-value="2">IIR</button>
+        </div>
+    </div>
     <div class="setting-container">
         <div class="description">Speed (SPS)</div>
         <div class="button-group">
@@ -372,6 +405,12 @@ const char PROGMEM config_html[] = R"rawliteral(
             <input type="text" id="rate_default" placeholder="Enter value" oninput="updateValue('rate_default', this.value)">
         </div>
     </div>
+    <div class="setting-container">
+        <div class="description">Rate Max StdDev [g/s]</div>
+        <div class="text-input">
+            <input type="text" id="rate_max_std" placeholder="Enter value" oninput="updateValue('rate_max_std', this.value)">
+        </div>
+    </div>
     <div class="setting-container">
         <div class="description">Top Up Timeout [ms]</div>
         <div class="text-input">
@@ -408,6 +447,132 @@ const char PROGMEM config_html[] = R"rawliteral(
             <input type="text" id="stability_max_wait_ms" placeholder="Enter value" oninput="updateValue('stability_max_wait_ms', this.value)">
         </div>
     </div>
+    <div class="setting-container">
+        <div class="description">Stability Window [samples]</div>
+        <div class="text-input">
+            <input type="text" id="stability_window" placeholder="Enter value" oninput="updateValue('stability_window', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Stability Max StdDev [g]</div>
+        <div class="text-input">
+            <input type="text" id="stability_max_std" placeholder="Enter value" oninput="updateValue('stability_max_std', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Stability Max Slope [g/s]</div>
+        <div class="text-input">
+            <input type="text" id="stability_max_slope" placeholder="Enter value" oninput="updateValue('stability_max_slope', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Stability Min Confidence (0.0-1.0)</div>
+        <div class="text-input">
+            <input type="text" id="stability_min_confidence" placeholder="Enter value" oninput="updateValue('stability_min_confidence', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Tare Target Error [g]</div>
+        <div class="text-input">
+            <input type="text" id="tare_target_error" placeholder="Enter value" oninput="updateValue('tare_target_error', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Tare Min Samples</div>
+        <div class="text-input">
+            <input type="text" id="tare_min_samples" placeholder="Enter value" oninput="updateValue('tare_min_samples', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Display Decimation [samples]</div>
+        <div class="text-input">
+            <input type="text" id="display_decimation" placeholder="Enter value" oninput="updateValue('display_decimation', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Display Smoothing (IIR shift)</div>
+        <div class="text-input">
+            <input type="text" id="display_smoothing" placeholder="Enter value" oninput="updateValue('display_smoothing', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Zero Tracking Band [g] (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="zero_tracking_band" placeholder="Enter value" oninput="updateValue('zero_tracking_band', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Zero Tracking Time Constant [s]</div>
+        <div class="text-input">
+            <input type="text" id="zero_tracking_tau_s" placeholder="Enter value" oninput="updateValue('zero_tracking_tau_s', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Auto Tune Top Up Margins (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="auto_tune_margins" placeholder="Enter value" oninput="updateValue('auto_tune_margins', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Pulsed Approach Fraction (0.0-1.0, 0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="approach_fraction" placeholder="Enter value" oninput="updateValue('approach_fraction', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Approach Tolerance [g]</div>
+        <div class="text-input">
+            <input type="text" id="approach_tolerance" placeholder="Enter value" oninput="updateValue('approach_tolerance', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Approach Time Budget [ms]</div>
+        <div class="text-input">
+            <input type="text" id="approach_budget_ms" placeholder="Enter value" oninput="updateValue('approach_budget_ms', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">No Flow Abort [ms] (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="anomaly_no_flow_ms" placeholder="Enter value" oninput="updateValue('anomaly_no_flow_ms', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Flow Stall Abort [ms] (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="anomaly_stall_ms" placeholder="Enter value" oninput="updateValue('anomaly_stall_ms', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Cup Removal Step [g] (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="cup_removal_step" placeholder="Enter value" oninput="updateValue('cup_removal_step', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Auto Start on Portafilter (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="auto_start" placeholder="Enter value" oninput="updateValue('auto_start', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Batch Cups per Dose Button (0 = off)</div>
+        <div class="text-input">
+            <input type="text" id="batch_cups" placeholder="Enter value" oninput="updateValue('batch_cups', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Espresso Yield [g]</div>
+        <div class="text-input">
+            <input type="text" id="espresso_yield" placeholder="Enter value" oninput="updateValue('espresso_yield', this.value)">
+        </div>
+    </div>
+    <div class="setting-container">
+        <div class="description">Bean Profile (0 - 3)</div>
+        <div class="text-input">
+            <input type="text" id="profile" placeholder="Enter value" oninput="updateValue('profile', this.value)">
+        </div>
+    </div>
     <div class="setting-container">
         <div class="description">Button Debounce [ms]</div>
         <div class="text-input">
@@ -459,6 +624,17 @@ void onConnect(AsyncWebServerRequest *request) {
 
 const int WebSocketSettings::EEPROM_SCALE_ADDRESS = 0;
 
+// Bytes of Scale that a version stored, everything up to the first field of
+// the next version. Settings from before the version end at the magic.
+static size_t storedScaleSize(uint16_t version) {
+  switch (version) {
+    case WebSocketSettings::Scale::VERSION:
+      return offsetof(WebSocketSettings::Scale, is_changed);
+    default:
+      return offsetof(WebSocketSettings::Scale, version);
+  }
+}
+
 WebSocketSettings::WebSocketSettings()
     : _ws("/WebSocketSettings"), _server(nullptr), _logger(nullptr) {}
 
@@ -612,6 +788,98 @@ void WebSocketSettings::handleWebSocketText(const String &cmd,
         scale.screensaver_timeout_s = obj["screensaver_timeout_s"];
         changed = true;
       }
+      if (obj.containsKey("filter_type")) {
+        scale.filter_type = obj["filter_type"];
+        changed = true;
+      }
+      if (obj.containsKey("rate_max_std")) {
+        scale.rate_max_std = obj["rate_max_std"];
+        changed = true;
+      }
+      if (obj.containsKey("stability_window")) {
+        scale.stability_window = obj["stability_window"];
+        changed = true;
+      }
+      if (obj.containsKey("stability_max_std")) {
+        scale.stability_max_std = obj["stability_max_std"];
+        changed = true;
+      }
+      if (obj.containsKey("stability_max_slope")) {
+        scale.stability_max_slope = obj["stability_max_slope"];
+        changed = true;
+      }
+      if (obj.containsKey("stability_min_confidence")) {
+        scale.stability_min_confidence = obj["stability_min_confidence"];
+        changed = true;
+      }
+      if (obj.containsKey("tare_target_error")) {
+        scale.tare_target_error = obj["tare_target_error"];
+        changed = true;
+      }
+      if (obj.containsKey("tare_min_samples")) {
+        scale.tare_min_samples = obj["tare_min_samples"];
+        changed = true;
+      }
+      if (obj.containsKey("display_decimation")) {
+        scale.display_decimation = obj["display_decimation"];
+        changed = true;
+      }
+      if (obj.containsKey("display_smoothing")) {
+        scale.display_smoothing = obj["display_smoothing"];
+        changed = true;
+      }
+      if (obj.containsKey("zero_tracking_band")) {
+        scale.zero_tracking_band = obj["zero_tracking_band"];
+        changed = true;
+      }
+      if (obj.containsKey("zero_tracking_tau_s")) {
+        scale.zero_tracking_tau_s = obj["zero_tracking_tau_s"];
+        changed = true;
+      }
+      if (obj.containsKey("auto_tune_margins")) {
+        scale.auto_tune_margins = obj["auto_tune_margins"];
+        changed = true;
+      }
+      if (obj.containsKey("approach_fraction")) {
+        scale.approach_fraction = obj["approach_fraction"];
+        changed = true;
+      }
+      if (obj.containsKey("approach_tolerance")) {
+        scale.approach_tolerance = obj["approach_tolerance"];
+        changed = true;
+      }
+      if (obj.containsKey("approach_budget_ms")) {
+        scale.approach_budget_ms = obj["approach_budget_ms"];
+        changed = true;
+      }
+      if (obj.containsKey("anomaly_no_flow_ms")) {
+        scale.anomaly_no_flow_ms = obj["anomaly_no_flow_ms"];
+        changed = true;
+      }
+      if (obj.containsKey("anomaly_stall_ms")) {
+        scale.anomaly_stall_ms = obj["anomaly_stall_ms"];
+        changed = true;
+      }
+      if (obj.containsKey("cup_removal_step")) {
+        scale.cup_removal_step = obj["cup_removal_step"];
+        changed = true;
+      }
+      if (obj.containsKey("auto_start")) {
+        scale.auto_start = obj["auto_start"];
+        changed = true;
+      }
+      if (obj.containsKey("batch_cups")) {
+        scale.batch_cups = obj["batch_cups"];
+        changed = true;
+      }
+      if (obj.containsKey("espresso_yield")) {
+        scale.espresso_yield = obj["espresso_yield"];
+        changed = true;
+      }
+      if (obj.containsKey("profile")) {
+        scale.profile = obj["profile"];
+        changed = true;
+      }
 
       if (obj.containsKey("resetWiFi") && obj["resetWiFi"]) {
         wifi.reset_flag = true;
@@ -681,6 +949,52 @@ void WebSocketSettings::handleWebSocketText(const String &cmd,
         scale.min_topup_interval_ms = value.toInt();
       } else if (varName == "screensaver_timeout_s") {
         scale.screensaver_timeout_s = value.toInt();
+      } else if (varName == "filter_type") {
+        scale.filter_type = value.toInt();
+      } else if (varName == "rate_max_std") {
+        scale.rate_max_std = value.toFloat();
+      } else if (varName == "stability_window") {
+        scale.stability_window = value.toInt();
+      } else if (varName == "stability_max_std") {
+        scale.stability_max_std = value.toFloat();
+      } else if (varName == "stability_max_slope") {
+        scale.stability_max_slope = value.toFloat();
+      } else if (varName == "stability_min_confidence") {
+        scale.stability_min_confidence = value.toFloat();
+      } else if (varName == "tare_target_error") {
+        scale.tare_target_error = value.toFloat();
+      } else if (varName == "tare_min_samples") {
+        scale.tare_min_samples = value.toInt();
+      } else if (varName == "display_decimation") {
+        scale.display_decimation = value.toInt();
+      } else if (varName == "display_smoothing") {
+        scale.display_smoothing = value.toInt();
+      } else if (varName == "zero_tracking_band") {
+        scale.zero_tracking_band = value.toFloat();
+      } else if (varName == "zero_tracking_tau_s") {
+        scale.zero_tracking_tau_s = value.toFloat();
+      } else if (varName == "auto_tune_margins") {
+        scale.auto_tune_margins = value.toInt();
+      } else if (varName == "approach_fraction") {
+        scale.approach_fraction = value.toFloat();
+      } else if (varName == "approach_tolerance") {
+        scale.approach_tolerance = value.toFloat();
+      } else if (varName == "approach_budget_ms") {
+        scale.approach_budget_ms = value.toInt();
+      } else if (varName == "anomaly_no_flow_ms") {
+        scale.anomaly_no_flow_ms = value.toInt();
+      } else if (varName == "anomaly_stall_ms") {
+        scale.anomaly_stall_ms = value.toInt();
+      } else if (varName == "cup_removal_step") {
+        scale.cup_removal_step = value.toFloat();
+      } else if (varName == "auto_start") {
+        scale.auto_start = value.toInt();
+      } else if (varName == "batch_cups") {
+        scale.batch_cups = value.toInt();
+      } else if (varName == "espresso_yield") {
+        scale.espresso_yield = value.toFloat();
+      } else if (varName == "profile") {
+        scale.profile = value.toInt();
       } else if (varName == "resetWiFi") {
         wifi.reset_flag = true;
       }
@@ -691,7 +1005,7 @@ void WebSocketSettings::handleWebSocketText(const String &cmd,
   }
 
   // Response contains all settings
-  StaticJsonDocument<512> jsonDoc;
+  StaticJsonDocument<1024> jsonDoc;
   char cds_rounded[8], cdd_rounded[8], min_topup_rounded[8];
   sprintf(cds_rounded, "%1.2f", scale.top_up_margin_single);
   sprintf(cdd_rounded, "%1.2f", scale.top_up_margin_double);
@@ -719,6 +1033,29 @@ void WebSocketSettings::handleWebSocketText(const String &cmd,
   jsonDoc["min_topup_runtime_ms"] = scale.min_topup_runtime_ms;
   jsonDoc["min_topup_interval_ms"] = scale.min_topup_interval_ms;
   jsonDoc["screensaver_timeout_s"] = scale.screensaver_timeout_s;
+  jsonDoc["filter_type"] = scale.filter_type;
+  jsonDoc["rate_max_std"] = scale.rate_max_std;
+  jsonDoc["stability_window"] = scale.stability_window;
+  jsonDoc["stability_max_std"] = scale.stability_max_std;
+  jsonDoc["stability_max_slope"] = scale.stability_max_slope;
+  jsonDoc["stability_min_confidence"] = scale.stability_min_confidence;
+  jsonDoc["tare_target_error"] = scale.tare_target_error;
+  jsonDoc["tare_min_samples"] = scale.tare_min_samples;
+  jsonDoc["display_decimation"] = scale.display_decimation;
+  jsonDoc["display_smoothing"] = scale.display_smoothing;
+  jsonDoc["zero_tracking_band"] = scale.zero_tracking_band;
+  jsonDoc["zero_tracking_tau_s"] = scale.zero_tracking_tau_s;
+  jsonDoc["auto_tune_margins"] = scale.auto_tune_margins;
+  jsonDoc["approach_fraction"] = scale.approach_fraction;
+  jsonDoc["approach_tolerance"] = scale.approach_tolerance;
+  jsonDoc["approach_budget_ms"] = scale.approach_budget_ms;
+  jsonDoc["anomaly_no_flow_ms"] = scale.anomaly_no_flow_ms;
+  jsonDoc["anomaly_stall_ms"] = scale.anomaly_stall_ms;
+  jsonDoc["cup_removal_step"] = scale.cup_removal_step;
+  jsonDoc["auto_start"] = scale.auto_start;
+  jsonDoc["batch_cups"] = scale.batch_cups;
+  jsonDoc["espresso_yield"] = scale.espresso_yield;
+  jsonDoc["profile"] = scale.profile;
 
   serializeJson(jsonDoc, response);
 }
@@ -729,8 +1066,17 @@ void WebSocketSettings::loadScaleFromEEPROM() {
   EEPROM.get(EEPROM_SCALE_ADDRESS, tempScale);
   EEPROM.end();
 
-  if (tempScale.magic == scale.magic) {
+  if (tempScale.magic == scale.magic &&
+      tempScale.version == Scale::VERSION) {
     scale = tempScale;
+  } else if (tempScale.magic == scale.magic) {
+    // an older version, or from before there was one: keep what it stored,
+    // the fields added since keep their defaults
+    _logger->println("Migrating settings from version " +
+                     String(tempScale.version));
+    memcpy(&scale, &tempScale, storedScaleSize(tempScale.version));
+    scale.version = Scale::VERSION;
+    saveScaleToEEPROM();
   } else {
     _logger->println("Invalid EEPROM magic, resetting advanced settings");
     // Preserve basic settings from EEPROM (assuming they are at the start of
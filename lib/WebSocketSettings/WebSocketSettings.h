@@ -36,6 +36,39 @@ class WebSocketSettings {
 
     uint32_t magic = 0xCAFEBABE;
 
+    // Everything above is the layout from before the version. New fields are
+    // appended below in the order they were added, then VERSION is bumped
+    // and loadScaleFromEEPROM() told where the previous version ended, so an
+    // update keeps the stored settings and only the new fields start out
+    // with their defaults.
+    static constexpr uint16_t VERSION = 1;
+    uint16_t version = VERSION;
+
+    // version 1
+    byte filter_type = 0;  // scalefilter::FilterType
+    float rate_max_std = 0.08f;
+    byte stability_window = 24;
+    float stability_max_std = 0.03f;
+    float stability_max_slope = 0.1f;
+    float stability_min_confidence = 0.5f;
+    float tare_target_error = 0.005f;
+    byte tare_min_samples = 8;
+    byte display_decimation = 8;
+    byte display_smoothing = 2;
+    float zero_tracking_band = 0.2f;
+    float zero_tracking_tau_s = 10.0f;
+    byte auto_tune_margins = 1;
+    float approach_fraction = 0.0f;
+    float approach_tolerance = 0.05f;
+    unsigned long approach_budget_ms = 6000;
+    unsigned long anomaly_no_flow_ms = 4000;
+    unsigned long anomaly_stall_ms = 1500;
+    float cup_removal_step = 3.0f;
+    byte auto_start = 0;
+    byte batch_cups = 0;
+    float espresso_yield = 36.0f;
+    byte profile = 0;
+
     bool is_changed = false;
   };
 
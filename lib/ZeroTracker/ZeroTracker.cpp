@@ -0,0 +1,122 @@
+#include "ZeroTracker.h"
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+static const char *PREFS_NAMESPACE = "zero";
+static const char *PREFS_REFERENCE = "reference";
+static const char *PREFS_DELTA = "delta";
+
+// the delta is folded into the reference once it gets this large, where a
+// float still resolves far below a Q step
+static const float REBASE_COUNTS = 1024.0f;
+
+ZeroTracker::ZeroTracker()
+    : _gramsPerCount(1.0f),
+      _band(0.0f),
+      _tau(10.0f),
+      _valid(false),
+      _startup(true),
+      _attached(false),
+      _reference(0),
+      _delta(0.0f),
+      _applied(0.0f),
+      _saved(0.0f),
+      _savedMillis(0),
+      _empty(false),
+      _lastUs(0) {}
+
+bool ZeroTracker::begin() {
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, true);
+  _valid = prefs.isKey(PREFS_REFERENCE) && prefs.isKey(PREFS_DELTA);
+  if (_valid) {
+    _reference = prefs.getInt(PREFS_REFERENCE, 0);
+    _delta = prefs.getFloat(PREFS_DELTA, 0.0f);
+    _saved = _delta;
+  }
+  prefs.end();
+  _startup = true;
+  _attached = false;
+  return _valid;
+}
+
+void ZeroTracker::configure(float gramsPerCount, float band, float tau) {
+  _gramsPerCount = fabsf(gramsPerCount);
+  _band = band;
+  _tau = tau > 0 ? tau : 0.1f;
+}
+
+bool ZeroTracker::update(float meanCounts, bool stable, int64_t timestampUs) {
+  int64_t lastUs = _lastUs;
+  _lastUs = timestampUs;
+  _empty = false;
+  if (!stable || _band <= 0) {
+    return false;
+  }
+
+  float error = (meanCounts - _reference - _delta) * _gramsPerCount;
+  if (_startup) {
+    // first stable reading after boot
+    _startup = false;
+    if (!_valid || fabsf(error) <= STARTUP_RANGE_G) {
+      // keep the saved delta relative to the new reference
+      int32_t reference = lroundf(meanCounts);
+      _saved += _reference - reference;
+      _reference = reference;
+      _delta = meanCounts - reference;
+      _valid = true;
+      _empty = true;
+      _attached = true;
+      _applied = _delta;
+      return true;
+    }
+    return false;
+  }
+  if (!_valid || fabsf(error) > _band) {
+    return false;
+  }
+  _empty = true;
+
+  if (lastUs > 0 && timestampUs > lastUs) {
+    float dt = (timestampUs - lastUs) / 1e6f;
+    float alpha = dt / (_tau + dt);
+    _delta += alpha * (meanCounts - _reference - _delta);
+    if (fabsf(_delta) >= REBASE_COUNTS) {
+      rebase();
+    }
+  }
+
+  // one Q step of the sampler is 1/16 count, don't apply anything smaller
+  if (!_attached || fabsf(_delta - _applied) >= 1.0f / 16) {
+    _attached = true;
+    _applied = _delta;
+    return true;
+  }
+  return false;
+}
+
+void ZeroTracker::rebase() {
+  int32_t shift = lroundf(_delta);
+  _reference += shift;
+  _delta -= shift;
+  _applied -= shift;
+  _saved -= shift;
+}
+
+void ZeroTracker::save(bool force) {
+  if (!_valid ||
+      fabsf(_delta - _saved) * _gramsPerCount < SAVE_THRESHOLD_G) {
+    return;
+  }
+  if (!force && millis() - _savedMillis < SAVE_INTERVAL_MS) {
+    return;
+  }
+  Preferences prefs;
+  prefs.begin(PREFS_NAMESPACE, false);
+  prefs.putInt(PREFS_REFERENCE, _reference);
+  prefs.putFloat(PREFS_DELTA, _delta);
+  prefs.end();
+  _saved = _delta;
+  _savedMillis = millis();
+}
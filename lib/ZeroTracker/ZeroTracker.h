@@ -0,0 +1,71 @@
+#pragma once
+#include <stdint.h>
+
+// Automatic zero tracking for the empty scale.
+//
+// Keeps an estimate of the raw counts that correspond to an empty platform.
+// While the scale is stable and the reading is within band of that estimate,
+// the estimate follows the reading with a first order lag of time constant
+// tau, which absorbs thermal drift and load cell creep without following real
+// loads (anything outside the band is ignored).
+//
+// The estimate is an int32 reference plus a float delta from it. A float of
+// the absolute counts (around 2^20 and more) has steps far coarser than what
+// a slow tau moves it by per update, so it would stop following the drift.
+//
+// The estimate is kept in NVS, so a power cycle starts from the last known
+// zero instead of from whatever happens to be on the scale. The first stable
+// reading after boot within STARTUP_RANGE_G of the stored zero is taken over
+// right away, and without a stored zero the first stable reading is used.
+class ZeroTracker {
+ public:
+  static constexpr float STARTUP_RANGE_G = 5.0f;
+  // write to flash at most this often, and only after a relevant change
+  static constexpr uint32_t SAVE_INTERVAL_MS = 10 * 60 * 1000;
+  static constexpr float SAVE_THRESHOLD_G = 0.01f;
+
+  ZeroTracker();
+
+  // Load the stored zero. Returns true if there was one.
+  bool begin();
+
+  // band in grams (0 disables tracking), tau in seconds
+  void configure(float gramsPerCount, float band, float tau);
+
+  // Feed the stable window mean in raw counts. Returns true when the offset
+  // moved enough to be applied as zero point again.
+  bool update(float meanCounts, bool stable, int64_t timestampUs);
+
+  // The zero point was replaced by something else (e.g. a tare with a cup),
+  // apply the tracked offset again on the next tracking update.
+  void detach() { _attached = false; }
+
+  bool hasOffset() const { return _valid; }
+  // Zero point in raw counts
+  float getOffset() const { return _reference + _delta; }
+  // The last update saw a stable, empty scale
+  bool isEmpty() const { return _empty; }
+
+  // Persist the offset if it drifted and the last save is old enough
+  void save(bool force = false);
+
+ private:
+  float _gramsPerCount;
+  float _band;
+  float _tau;
+
+  bool _valid;
+  bool _startup;
+  bool _attached;
+  // move what the delta grew to into the reference, keeping it small
+  void rebase();
+
+  int32_t _reference;
+  float _delta;
+  // offsets last applied and saved, as deltas from _reference
+  float _applied;
+  float _saved;
+  uint32_t _savedMillis;
+  bool _empty;
+  int64_t _lastUs;
+};
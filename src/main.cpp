@@ -8,22 +8,43 @@
 // needs to be included after WiFiManager.h
 // which does not properly protect some defines
 #include <API.h>
+#include <AfterflowModel.h>
+#include <DeadTimeEstimator.h>
 #include <Display.h>
+#include <DoseQueue.h>
 #include <ESPAsyncWebServer.h>
+#include <FlowAnomalyDetector.h>
+#include <FlowEstimator.h>
+#include <MarginTuner.h>
+#include <PortafilterSignatures.h>
+#include <ProfileStore.h>
+#include <PulseModel.h>
+#include <RatePrior.h>
 #include <RawDataWebSocket.h>
+#include <RelayScheduler.h>
+#include <SampleCapture.h>
+#include <ScaleSampler.h>
+#include <ShotTimer.h>
+#include <StabilityDetector.h>
+#include <StateMachine.h>
+#include <TareEngine.h>
 #include <WebSocketGraph.h>
 #include <WebSocketLogger.h>
 #include <WebSocketMetrics.h>
 #include <WebSocketSettings.h>
+#include <ZeroTracker.h>
 #include <time.h>
 
 #include "defines.h"
+#include "esp_timer.h"
 
 #define GRAMS_DIGITS 1
 #define TIME_DIGITS 1
 
 ADS1232 scale = ADS1232(ADC_PDWN_PIN, ADC_SCLK_PIN, ADC_DOUT_PIN, ADC_SPEED_PIN,
                         ADC_GAIN1_PIN, ADC_GAIN0_PIN);
+ScaleSampler sampler(scale);
+RelayScheduler relay(GRINDER_RELAY_PIN);
 Display display(DISPLAY_SCK_PIN, DISPLAY_MISO_PIN, DISPLAY_MOSI_PIN,
                 DISPLAY_SS_PIN, DISPLAY_DC_PIN, DISPLAY_CS_PIN,
                 DISPLAY_RESET_PIN, DISPLAY_BACKLIGHT_PIN);
@@ -35,42 +56,155 @@ WebSocketSettings settings;
 WebSocketGraph graph;
 WebSocketMetrics metrics;
 RawDataWebSocket rawData;
+SampleCapture capture;
+FlowEstimator flow;
+FlowAnomalyDetector anomaly;
+StabilityDetector stability;
+TareEngine tare;
+// running zero while the scale waits for a dose, committed on confirm
+TareEngine baseline;
+ZeroTracker zeroTracker;
+
+enum DoseSlot { DOSE_SINGLE = 0, DOSE_DOUBLE, DOSE_SLOTS };
+// learned grams after relay-off, one model per dose button
+AfterflowModel afterflow[DOSE_SLOTS];
+// flow rate of the recent grinds, one per dose button
+RatePrior ratePrior[DOSE_SLOTS];
+// learned grams per top-up pulse
+PulseModel pulse;
+// relay on -> first grounds, relay off -> weight stops rising. These are the
+// relay's and the motor's, whatever the beans, so one for all profiles.
+DeadTimeEstimator deadTime;
+// tunes the margins of the active profile, which are passed in and handed
+// back, the history it keeps is a log of all profiles
+MarginTuner tuner;
+// doses and margins per bean, the models above are loaded for the active one
+ProfileStore profiles;
+// empty portafilter of each dose button, learned at every tare
+PortafilterSignatures signatures;
+static_assert(PortafilterSignatures::SLOTS == DOSE_SLOTS,
+              "one signature per dose button");
+// doses still to grind, each into a new cup
+DoseQueue batch;
+// espresso mode, weighs a shot as it pours
+ShotTimer shot;
 
 // minimum time to hold the button to be counted as true press (filter noise)
 static const unsigned long button_debounce_min_hold = 20;
 
+// how long loop() sleeps waiting for a conversion: the control states give
+// up after a few conversion periods at 10 SPS so their timeouts still fire,
+// the others need to come around often for buttons, API and OTA
+static const uint32_t control_sample_timeout_ms = 250;
+static const uint32_t idle_loop_period_ms = 10;
+
+// between two doses of a batch, the weight has to settle this far above the
+// lowest reading seen since the last dose for a new cup to count as placed
+static const float cup_swap_step_g = 3.0f;
+
+// double press of the back button selects the next bean profile: the second
+// press has to come after the bounces of the first one and before this
+static const unsigned long back_double_press_min = 150;
+static const unsigned long back_double_press_max = 600;
+// how long the name of a newly selected profile is shown
+static const unsigned long profile_banner_ms = 1500;
+
 bool grinder_is_running = false;
 
+// latest conversion handed over by the acquisition task
+ScaleSample sample;
+// the slow display stream moved on during the last drainSamples()
+bool display_sample_ready = false;
+// when the last tare was committed, to wait for a post-tare reading
+int64_t tare_done_us = 0;
+// smoothed time between two conversions, measured on the DRDY timestamps
+float sample_interval_us = 0.0f;
+
 float target_grams = 0;
 float target_grams_corrected = 0;  // includes the correction dose
 
 // various millis to keep track of when stuff happened
 unsigned long button_pressed_filter_millis = 0;
 unsigned long button_pressed_millis = 0;
+unsigned long back_pressed_millis = 0;
+unsigned long back_interrupt_millis = 0;  // last back edge that was posted
+unsigned long profile_switched_millis = 0;
 unsigned long debug_last_print_millis = 0;
 unsigned long finalize_millis = 0;
 unsigned long grinder_runtime_millis = 0;  // how long the grinder was on for
 unsigned long grinder_started_millis = 0;  // when the grinder was started
 unsigned long grinder_stopped_millis = 0;  // when the grinder was stopped
-unsigned long last_grams_millis = 0;
 unsigned long last_heartbeat_millis = 0;
 unsigned long last_top_up_millis = 0;
-unsigned long last_zero_weight_millis = 0;
-unsigned long calculated_stop_millis = 0;
 bool stop_time_calculated = false;
 unsigned long session_started_millis = 0;  // when the grind session was started
-volatile unsigned long state_change_to_idle_millis = 0;
+unsigned long state_change_to_idle_millis = 0;
 unsigned long stability_wait_start_millis = 0;
-unsigned long top_up_stop_millis = 0;
+
+// sample timestamps (esp_timer, microseconds) used for rate and lag math
+int64_t grinder_started_us = 0;     // when the grinder was started
+int64_t grinder_stopped_us = 0;     // when the relay actually switched off
+int64_t last_grams_us = 0;          // sample time of last_grams
+int64_t last_zero_weight_us = 0;    // sample time of the last reading < 0.1 g
+int64_t flow_started_us = 0;        // estimated start of flow, 0 if unknown
+int64_t calculated_stop_us = 0;     // when the grinder should be stopped
 
 // various grams values to calculate differences between iterations
 float grams_on_grinder_on = 0.0f;  // grams when grinder was turned on
 float last_grams = 0.0f;
 float top_up_grams_delta = 0.0f;
 
-// to calculate the grams per second rate for the current run
-float grams_per_seconds_total = 0;
-uint16_t grams_per_seconds_count = 0;
+// relay-off state of the main run, learned once the cup has settled
+DoseSlot dose_slot = DOSE_SINGLE;
+bool afterflow_pending = false;
+float afterflow_off_grams = 0.0f;
+float afterflow_off_rate = 0.0f;
+float afterflow_runtime_s = 0.0f;
+// dead times of the main run, measured on the way
+bool on_delay_measured = false;
+float on_delay_s = 0.0f;
+bool off_delay_pending = false;
+float off_peak_grams = 0.0f;      // highest weight since relay-off
+int64_t off_last_rise_us = 0;     // when the weight last rose above it
+// the last relay run (main run or top-up pulse) is over and has not been
+// reported and learned from yet, once per run however long it settles
+bool run_result_pending = false;
+// pulsed approach of the last approach_fraction of the dose, top-ups are
+// then short pulses decided on the first stable reading
+bool approach_active = false;
+unsigned long approach_started_millis = 0;
+// smallest approach pulse, the pulse model decides what it delivers
+static const float approach_min_pulse_s = 0.05f;
+// why the last grind was aborted
+FlowAnomalyDetector::Anomaly fault = FlowAnomalyDetector::NONE;
+unsigned long fault_millis = 0;
+// the main run stopped on a top-up margin that may be tuned
+bool margin_session = false;
+// the tare is a portafilter: a single dose button press or one recognized by
+// auto start. API doses, batch cups and espresso tare other containers.
+bool signature_session = false;
+uint8_t top_up_count = 0;
+// auto start: armed once the scale was seen empty, so a portafilter that is
+// left on the scale starts one grind only
+bool auto_start_armed = false;
+// the grind was started by the portafilter, tare to the weight it was
+// recognized at
+bool auto_tare_pending = false;
+float auto_tare_offset = 0.0f;
+// lowest weight since the last dose of the batch, the scale without a cup
+float swap_low_grams = 0.0f;
+// espresso mode: the cup is tared once it settled, every sample is fed to
+// the shot timer once, the summary is sent once
+bool shot_tared = false;
+bool shot_reported = false;
+int64_t shot_sample_us = 0;
+// the name of the profile is shown instead of the idle screen
+bool profile_banner = false;
+
+// weight / flow tracking for the current run, fed with every sample
+bool flow_tracking = false;
+// flow rate estimate when the grinder was stopped, used to size top ups
+float grind_rate = 0.0f;
 
 // determined in finalize, displayed in stopping
 float finalize_time = 0;
@@ -78,10 +212,9 @@ float finalize_grams = 0;
 // ensure finalize events (graph + metrics) are only broadcast once
 bool finalize_broadcast_done = false;
 
-volatile enum State {
+enum State {
   IDLE = 0,
   BUTTON_FILTER,
-  BUTTON_PRESSED,
   CONFIRM,
   TARE,
   CONFIGURED,
@@ -91,11 +224,11 @@ volatile enum State {
   FINALIZE,
   SCREENSAVER,
   DEBUG,
-} state;
-// previous state when in loop
-State old_state_loop = IDLE;
-// previous state when button press interrupt is handled
-State old_state_button_press = IDLE;
+  FAULT,
+  CUP_SWAP,
+  ESPRESSO,
+  STATE_COUNT,
+};
 
 enum ButtonPin {
   none = 0,
@@ -104,19 +237,111 @@ enum ButtonPin {
   back = BUTTON_BACK,
 };
 
-volatile ButtonPin button;       // the button that was currently pressed
-volatile ButtonPin last_button;  // the button that was previously pressed
+// posted by the button interrupts and the API, or raised by a state once it
+// is done with its part
+enum EventType {
+  EVENT_BUTTON = 0,
+  EVENT_DOSE_REQUEST,
+  EVENT_DONE,
+  EVENT_TIMEOUT,
+  EVENT_CANCEL,
+  EVENT_FAULT,
+  EVENT_AUTO_START,
+  EVENT_BATCH,
+  EVENT_ESPRESSO,
+};
+
+struct Event {
+  EventType type;
+  ButtonPin pin;  // EVENT_BUTTON
+  float grams;    // EVENT_DOSE_REQUEST, EVENT_AUTO_START
+  DoseSlot slot;  // EVENT_AUTO_START
+};
+
+typedef StateMachine<State, Event, STATE_COUNT> Machine;
+
+// what is on the display, it is only cleared when this changes
+enum Screen {
+  SCREEN_NONE = 0,
+  SCREEN_IDLE,
+  SCREEN_CONFIRM,
+  SCREEN_TARE,
+  SCREEN_GRINDING,
+  SCREEN_SCREENSAVER,
+  SCREEN_DEBUG,
+  SCREEN_FAULT,
+  SCREEN_CUP_SWAP,
+  SCREEN_ESPRESSO,
+};
+Screen screen = SCREEN_NONE;
+
+ButtonPin button;       // the button that was currently pressed
+ButtonPin last_button;  // the button that was previously pressed
 
 void setupDisplay();
 void setupWifi();
 void setupScale();
 
+bool isSampleDriven(State state);
+uint32_t drainSamples();
+int64_t filterDelayMicros();
+void trackFlow(const ScaleSample &next);
+void trackBaseline(const ScaleSample &next);
+void trackZero(const ScaleSample &next);
+void trackCapture(const ScaleSample &next);
+void trackOffDelay(const ScaleSample &next);
+
+void showScreen(Screen next);
+
+void enterIdle();
+void enterConfirm();
+void exitConfirm();
+void enterTare();
+void enterGrinding();
+void enterStopping();
+void enterFinalize();
+void enterScreensaver();
+void enterDebug();
+void enterFault();
+void enterCupSwap();
+void enterEspresso();
+
+bool isDoseButton(const Event &event);
+bool isBackButton(const Event &event);
+bool isBackDoublePress(const Event &event);
+bool isBackBounce(const Event &event);
+void pressBack(const Event &event);
+void nextProfile(const Event &event);
+bool isConfirmPress(const Event &event);
+bool isCancelPress(const Event &event);
+void pressButton(const Event &event);
+void selectDose(const Event &event);
+void acceptDoseRequest(const Event &event);
+void acceptAutoStart(const Event &event);
+void setDose(DoseSlot slot);
+void setRequestedDose(float grams);
+bool hasBatchDose(const Event &event);
+bool takeBatchOffer(const Event &event);
+void rejectBatch(const Event &event);
+void acceptBatch(const Event &event);
+void nextBatchDose(const Event &event);
+void setBatchDose(float grams);
+void pressShotButton(const Event &event);
+void startShot();
+
 void loopIdle();
+void checkAutoStart();
+void restoreProfile();
+void checkProfile();
+ProfileStore::Doses currentDoses();
+void switchProfile(uint8_t index);
+void beginModels();
+void checkReset();
+void resetModels(uint8_t index);
 void loopButtonFilter();
-void loopButtonPressed();
-void loopButtonPressedDebug();
 void loopConfirm();
 void loopTare();
+void commitTare(float offset);
 void loopConfigured();
 void loopRunning();
 void loopTopUp();
@@ -124,6 +349,9 @@ void loopStopping();
 void loopFinalize();
 void loopScreensaver();
 void loopDebug();
+void loopFault();
+void loopCupSwap();
+void loopEspresso();
 
 void resetWifi();
 
@@ -131,9 +359,91 @@ void heartbeat();
 
 void grinderOn();
 void grinderOff();
+void learnAfterflow(float settled_grams);
+void learnPulse(float seconds, float grams);
+void learnDeadTime();
+void recordSession();
 
 uint16_t getConnectionIndicatorColor();
 
+// in the order of State
+const Machine::StateInfo states[STATE_COUNT] = {
+    {"IDLE", enterIdle, loopIdle, nullptr},
+    {"BUTTON_FILTER", nullptr, loopButtonFilter, nullptr},
+    {"CONFIRM", enterConfirm, loopConfirm, exitConfirm},
+    {"TARE", enterTare, loopTare, nullptr},
+    {"CONFIGURED", nullptr, loopConfigured, nullptr},
+    {"RUNNING", enterGrinding, loopRunning, nullptr},
+    {"TOPUP", enterGrinding, loopTopUp, nullptr},
+    {"STOPPING", enterStopping, loopStopping, nullptr},
+    {"FINALIZE", enterFinalize, loopFinalize, nullptr},
+    {"SCREENSAVER", enterScreensaver, loopScreensaver, nullptr},
+    {"DEBUG", enterDebug, loopDebug, nullptr},
+    {"FAULT", enterFault, loopFault, nullptr},
+    {"CUP_SWAP", enterCupSwap, loopCupSwap, nullptr},
+    {"ESPRESSO", enterEspresso, loopEspresso, nullptr},
+};
+
+// first match wins
+const Machine::Transition transitions[] = {
+    // left / right start a dose once the press survived the filter
+    {IDLE, EVENT_BUTTON, isDoseButton, pressButton, BUTTON_FILTER},
+    {SCREENSAVER, EVENT_BUTTON, isDoseButton, pressButton, BUTTON_FILTER},
+    {BUTTON_FILTER, EVENT_DONE, nullptr, selectDose, CONFIRM},
+    {BUTTON_FILTER, EVENT_CANCEL, nullptr, nullptr, IDLE},
+    // same button again confirms, the other one cancels
+    {CONFIRM, EVENT_BUTTON, isConfirmPress, nullptr, TARE},
+    {CONFIRM, EVENT_BUTTON, isCancelPress, nullptr, IDLE},
+    {CONFIRM, EVENT_TIMEOUT, nullptr, nullptr, IDLE},
+    {IDLE, EVENT_DOSE_REQUEST, nullptr, acceptDoseRequest, CONFIRM},
+    {SCREENSAVER, EVENT_DOSE_REQUEST, nullptr, acceptDoseRequest, CONFIRM},
+    // a known portafilter was put on the scale, no confirm needed
+    {IDLE, EVENT_AUTO_START, nullptr, acceptAutoStart, TARE},
+    // the first dose of a batch is confirmed like any other, an offer that
+    // was withdrawn in the meantime is reported and starts nothing
+    {IDLE, EVENT_BATCH, takeBatchOffer, acceptBatch, CONFIRM},
+    {SCREENSAVER, EVENT_BATCH, takeBatchOffer, acceptBatch, CONFIRM},
+    {IDLE, EVENT_BATCH, nullptr, rejectBatch, IDLE},
+    {SCREENSAVER, EVENT_BATCH, nullptr, rejectBatch, SCREENSAVER},
+    {IDLE, EVENT_BUTTON, isBackButton, pressBack, DEBUG},
+    // a quick second press selects the next bean profile
+    {DEBUG, EVENT_BUTTON, isBackDoublePress, nextProfile, IDLE},
+    // too early for a second press, stay and wait for the real one
+    {DEBUG, EVENT_BUTTON, isBackBounce, nullptr, DEBUG},
+    {DEBUG, EVENT_BUTTON, isBackButton, nullptr, IDLE},
+    {IDLE, EVENT_TIMEOUT, nullptr, nullptr, SCREENSAVER},
+    {SCREENSAVER, EVENT_CANCEL, nullptr, nullptr, IDLE},
+    // the grind session
+    {TARE, EVENT_DONE, nullptr, nullptr, CONFIGURED},
+    {CONFIGURED, EVENT_DONE, nullptr, nullptr, RUNNING},
+    {RUNNING, EVENT_DONE, nullptr, nullptr, TOPUP},
+    {RUNNING, EVENT_TIMEOUT, nullptr, nullptr, STOPPING},
+    {TOPUP, EVENT_DONE, nullptr, nullptr, STOPPING},
+    {STOPPING, EVENT_DONE, nullptr, nullptr, FINALIZE},
+    // more doses in the batch: wait for the next cup, any button stops
+    {FINALIZE, EVENT_TIMEOUT, hasBatchDose, nullptr, CUP_SWAP},
+    {FINALIZE, EVENT_CANCEL, hasBatchDose, nullptr, CUP_SWAP},
+    {CUP_SWAP, EVENT_DONE, hasBatchDose, nextBatchDose, TARE},
+    {CUP_SWAP, EVENT_CANCEL, nullptr, nullptr, IDLE},
+    {CUP_SWAP, EVENT_BUTTON, nullptr, nullptr, IDLE},
+    {FINALIZE, EVENT_TIMEOUT, nullptr, nullptr, IDLE},
+    {FINALIZE, EVENT_CANCEL, nullptr, nullptr, IDLE},
+    // a grind going nowhere is aborted, any button or the timeout clears it
+    {RUNNING, EVENT_FAULT, nullptr, nullptr, FAULT},
+    {TOPUP, EVENT_FAULT, nullptr, nullptr, FAULT},
+    {FAULT, EVENT_BUTTON, nullptr, nullptr, IDLE},
+    {FAULT, EVENT_TIMEOUT, nullptr, nullptr, IDLE},
+    // espresso mode, outside the grind session: back leaves, left / right
+    // end the shot or tare for the next one
+    {IDLE, EVENT_ESPRESSO, nullptr, nullptr, ESPRESSO},
+    {SCREENSAVER, EVENT_ESPRESSO, nullptr, nullptr, ESPRESSO},
+    {DEBUG, EVENT_BUTTON, isDoseButton, nullptr, ESPRESSO},
+    {ESPRESSO, EVENT_BUTTON, isBackButton, nullptr, IDLE},
+    {ESPRESSO, EVENT_BUTTON, isDoseButton, pressShotButton, ESPRESSO},
+};
+
+Machine fsm(states, transitions, sizeof(transitions) / sizeof(transitions[0]));
+
 template <ButtonPin pin>
 void IRAM_ATTR button_interrupt() {
   auto now = millis();
@@ -143,30 +453,14 @@ void IRAM_ATTR button_interrupt() {
     return;
   }
 
-  if (state == CONFIRM) {
-    // go to configured if same button is pressed again
-    // go to idle if the button is different
-    if (pin == last_button) {
-      state = TARE;
-    } else {
-      state = IDLE;
-      state_change_to_idle_millis = millis();
-    }
-  } else if (state == IDLE || state == SCREENSAVER) {
-    old_state_button_press = IDLE;
-    state = BUTTON_FILTER;
-    button = pin;
-  }
-
-  // reset the last_button to avoid auto-confirm / -cancel in the next run
-  last_button = none;
+  fsm.postFromISR({EVENT_BUTTON, pin, 0.0f});
 }
 
 void setup() {
   Serial.begin(115200);
 
   // grinder relay
-  pinMode(GRINDER_RELAY_PIN, OUTPUT);
+  relay.begin();
   grinderOff();
 
   // display
@@ -179,9 +473,27 @@ void setup() {
   logger.println("Logger ready");
 
   api.begin(server);
+  api.onDosage(
+      [](float grams) { fsm.post({EVENT_DOSE_REQUEST, none, grams}); });
+  api.onBatch([](const float *grams, uint8_t count) {
+    // only offered, acceptBatch() starts it if the scale is still idle
+    State state = fsm.getState();
+    if ((state != IDLE && state != SCREENSAVER) ||
+        !batch.offer(grams, count)) {
+      return false;
+    }
+    fsm.post({EVENT_BATCH});
+    return true;
+  });
+  api.onBatchCancel([]() { batch.clear(); });
+  api.onEspresso([]() { fsm.post({EVENT_ESPRESSO}); });
   logger.println("API ready");
 
+  tuner.begin(server);
+  profiles.begin(server);
+
   settings.begin(&server, &logger);
+  restoreProfile();
   logger.println("Settings ready");
 
   graph.begin(&server);
@@ -192,6 +504,12 @@ void setup() {
   rawData.begin(server, "/RawDataWebSocket", 10.0f);
   logger.println("Raw data WebSocket ready");
 
+  if (capture.begin(server)) {
+    logger.println("Sample capture ready");
+  } else {
+    logger.println("Sample capture disabled, LittleFS mount failed");
+  }
+
   ArduinoOTA.begin();
   ArduinoOTA.onStart([]() { display.clear(); });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
@@ -207,9 +525,18 @@ void setup() {
   // power up the scale circuit
   pinMode(ADC_LDO_EN_PIN, OUTPUT);
   digitalWrite(ADC_LDO_EN_PIN, HIGH);
+  beginModels();
+  deadTime.begin();
+  signatures.begin();
+
+  if (zeroTracker.begin()) {
+    logger.println("Using stored zero");
+  }
   setupScale();
+  sampler.begin(ADC_DOUT_PIN);
   logger.println("Scale ready");
 
+  // after sampler.begin(), the GPIO interrupts stay on the acquisition core
   pinMode(BUTTON_LEFT, INPUT_PULLUP);
   attachInterrupt(digitalPinToInterrupt(BUTTON_LEFT), button_interrupt<left>,
                   FALLING);
@@ -218,16 +545,16 @@ void setup() {
                   FALLING);
   pinMode(BUTTON_BACK, INPUT_PULLDOWN);
   auto back_button_isr = []() IRAM_ATTR {
-    old_state_button_press =
-        (state == BUTTON_PRESSED) ? old_state_button_press : state;
-    state = BUTTON_PRESSED;
-    button = back;
+    auto now = millis();
+    if ((now - back_interrupt_millis) < settings.scale.button_debounce_ms) {
+      return;
+    }
+    back_interrupt_millis = now;
+    fsm.postFromISR({EVENT_BUTTON, back, 0.0f});
   };
   attachInterrupt(digitalPinToInterrupt(BUTTON_BACK), back_button_isr, RISING);
 
-  display.clear();
-  state_change_to_idle_millis = millis();
-  state = IDLE;
+  fsm.begin(IDLE);
 }
 
 void setupScale() {
@@ -240,7 +567,34 @@ void setupScale() {
   scale.setCalFactor(settings.scale.calibration_factor);
   scale.setRingBufferSize(settings.scale.read_samples);
   scale.initRingBuffer();
-  scale.tare();
+  sampler.configure(settings.scale.read_samples,
+                    (scalefilter::FilterType)settings.scale.filter_type,
+                    settings.scale.calibration_factor);
+  sampler.configureDisplay(settings.scale.display_decimation,
+                           settings.scale.display_smoothing);
+  stability.configure(settings.scale.stability_window,
+                      settings.scale.calibration_factor,
+                      settings.scale.stability_max_std,
+                      settings.scale.stability_max_slope);
+  tare.configure(settings.scale.calibration_factor,
+                 settings.scale.stability_max_std,
+                 settings.scale.tare_target_error,
+                 settings.scale.tare_min_samples);
+  baseline.configure(settings.scale.calibration_factor,
+                     settings.scale.stability_max_std,
+                     settings.scale.tare_target_error,
+                     settings.scale.tare_min_samples);
+  baseline.stop();
+  anomaly.configure(settings.scale.anomaly_no_flow_ms,
+                    settings.scale.anomaly_stall_ms);
+  zeroTracker.configure(settings.scale.calibration_factor,
+                        settings.scale.zero_tracking_band,
+                        settings.scale.zero_tracking_tau_s);
+  if (zeroTracker.hasOffset()) {
+    sampler.setZero(zeroTracker.getOffset());
+  } else {
+    sampler.zero();
+  }
 
   settings.scale.is_changed = false;
 }
@@ -248,108 +602,179 @@ void setupScale() {
 void loop() {
   heartbeat();
 
-  // read the ADC if it's ready - this is close to non-blocking
-  scale.readADCIfReady();
+  sampler.waitForSample(isSampleDriven(fsm.getState())
+                            ? control_sample_timeout_ms
+                            : idle_loop_period_ms);
 
-  // don't call expensive functions between check and setting old_state_loop
-  // as new interrupts may occur in the meantime
-  bool need_to_clear = state != old_state_loop;
-  old_state_loop = state;
-  if (need_to_clear) {
-    display.clear();
+  // pick up the conversions the acquisition task has read in the meantime,
+  // the control states are dispatched once per sample from there
+  uint32_t drained = drainSamples();
+
+  if (drained == 0 || !isSampleDriven(fsm.getState())) {
+    // handle the button and API events, then run the current state
+    fsm.dispatch();
   }
-  switch (state) {
+}
+
+bool isSampleDriven(State state) {
+  return state == RUNNING || state == TOPUP || state == STOPPING ||
+         state == ESPRESSO;
+}
+
+uint32_t drainSamples() {
+  uint32_t drained = 0;
+  display_sample_ready = false;
+  ScaleSample next;
+  while (sampler.pop(next)) {
+    if (sample.timestamp_us > 0 && next.timestamp_us > sample.timestamp_us &&
+        next.sequence > sample.sequence) {
+      // per conversion, lost or flushed samples don't stretch it
+      float interval = (float)(next.timestamp_us - sample.timestamp_us) /
+                       (next.sequence - sample.sequence);
+      sample_interval_us = sample_interval_us > 0
+                               ? 0.9f * sample_interval_us + 0.1f * interval
+                               : interval;
+    }
+    sample = next;
+    ++drained;
+    display_sample_ready |= sample.display_update;
+    stability.update(sample.raw, sample.timestamp_us);
+    if (tare.isRunning()) {
+      tare.update(sample.raw);
+    }
+    trackBaseline(sample);
+    trackZero(sample);
+    trackCapture(sample);
+    if (flow_tracking) {
+      trackFlow(sample);
+    }
+    if (off_delay_pending) {
+      trackOffDelay(sample);
+    }
+    if (isSampleDriven(fsm.getState())) {
+      // control runs exactly once per conversion, never on a stale one
+      fsm.dispatch();
+      display_sample_ready = false;
+    }
+  }
+  return drained;
+}
+
+void trackBaseline(const ScaleSample &next) {
+  // keep the baseline going while nothing is on the move, loopTare() stops it
+  // once it has been used
+  switch (fsm.getState()) {
     case IDLE:
-      loopIdle();
-      break;
+    case SCREENSAVER:
     case BUTTON_FILTER:
-      loopButtonFilter();
-      break;
-    case BUTTON_PRESSED:
-      if (old_state_button_press == DEBUG) {
-        loopButtonPressedDebug();
-      } else if (old_state_button_press == IDLE) {
-        loopButtonPressed();
-      } else {
-        // ignore button press
-        state = old_state_button_press;
-      }
-      break;
     case CONFIRM:
-      loopConfirm();
-      break;
     case TARE:
-      loopTare();
-      break;
-    case CONFIGURED:
-      loopConfigured();
-      break;
-    case RUNNING:
-      loopRunning();
-      break;
-    case TOPUP:
-      loopTopUp();
-      break;
-    case STOPPING:
-      loopStopping();
+      if (!baseline.isRunning()) {
+        baseline.start(true);
+      }
+      baseline.update(next.raw);
       break;
-    case FINALIZE:
-      loopFinalize();
+    default:
+      if (baseline.isRunning()) {
+        baseline.stop();
+      }
       break;
+  }
+}
+
+void trackZero(const ScaleSample &next) {
+  // follow the drift of the empty scale until the grind is confirmed
+  switch (fsm.getState()) {
+    case IDLE:
     case SCREENSAVER:
-      loopScreensaver();
-      break;
-    case DEBUG:
-      loopDebug();
+    case CONFIRM:
+    case TARE:
+      if (zeroTracker.update(stability.getMean(), stability.isStable(),
+                             next.timestamp_us)) {
+        sampler.setZero(zeroTracker.getOffset());
+      }
       break;
     default:
       break;
   }
 }
 
+void trackCapture(const ScaleSample &next) {
+  // record everything from the tare up to the end of FINALIZE
+  State current = fsm.getState();
+  bool in_session = current >= CONFIGURED && current <= FINALIZE;
+  if (in_session && !capture.isRecording()) {
+    capture.beginSession();
+  } else if (!in_session && capture.isRecording()) {
+    capture.endSession();
+  }
+  capture.record(next, stability.isStable(), grinder_is_running, current);
+}
+
+void trackOffDelay(const ScaleSample &next) {
+  // the filtered reading describes the weight one group delay ago
+  int64_t timestamp_us = next.timestamp_us - filterDelayMicros();
+  if (timestamp_us <= grinder_stopped_us) {
+    return;
+  }
+  // only count clear steps, noise on a settled cup must not extend it
+  if (next.grams > off_peak_grams + 0.1f) {
+    off_peak_grams = next.grams;
+    off_last_rise_us = timestamp_us;
+  }
+}
+
+int64_t filterDelayMicros() {
+  return (int64_t)(sampler.getFilterDelay() * sample_interval_us);
+}
+
+void trackFlow(const ScaleSample &next) {
+  // the filtered reading describes the weight one group delay ago
+  int64_t timestamp_us = next.timestamp_us - filterDelayMicros();
+
+  // Track the start of flow on sample time. The last sample < 0.1g and the
+  // first one above bracket the moment the first grounds landed.
+  if (next.grams < 0.1) {
+    last_zero_weight_us = timestamp_us;
+    flow_started_us = 0;
+    flow.stop();
+    return;
+  }
+
+  if (flow_started_us == 0) {
+    flow_started_us = (last_zero_weight_us + timestamp_us) / 2;
+    if (!on_delay_measured && grinder_is_running) {
+      on_delay_measured = true;
+      on_delay_s = (flow_started_us - grinder_started_us) / 1e6f;
+      deadTime.addOnDelay(on_delay_s);
+    }
+    // start from the rate of the recent grinds, or from the default rate
+    // with a wide prior until there are some, the first second of flow
+    // pulls it in
+    const RatePrior &prior = ratePrior[dose_slot];
+    flow.reset(next.grams, prior.getRate(settings.scale.rate_default),
+               prior.getStdDev(settings.scale.rate_default), timestamp_us);
+    return;
+  }
+
+  flow.update(next.grams, timestamp_us);
+}
+
 void heartbeat() {
   if (millis() - last_heartbeat_millis > 5000) {
     String message = "[heartbeat] state=";
-    switch (state) {
-      case IDLE:
-        message += "IDLE";
-        break;
-      case BUTTON_FILTER:
-        message += "BUTTON_FILTER";
-        break;
-      case BUTTON_PRESSED:
-        message += "BUTTON_PRESSED";
-        break;
-      case CONFIGURED:
-        message += "CONFIGURED";
-        break;
-      case CONFIRM:
-        message += "CONFIRM";
-        break;
-      case TARE:
-        message += "TARE";
-        break;
-      case RUNNING:
-        message += "RUNNING";
-        break;
-      case TOPUP:
-        message += "TOPUP";
-        break;
-      case STOPPING:
-        message += "STOPPING";
-        break;
-      case FINALIZE:
-        message += "FINALIZE";
-        break;
-      case SCREENSAVER:
-        message += "SCREENSAVER";
-        break;
-      case DEBUG:
-        message += "DEBUG";
-        break;
-      default:
-        message += "UNHANDLED STATE: " + String((int)state);
-        break;
+    message += fsm.getStateName();
+    uint32_t dropped = sampler.getDropped();
+    if (dropped > 0) {
+      message += " dropped_samples=" + String(dropped);
+    }
+    uint32_t capture_dropped = capture.getDropped();
+    if (capture_dropped > 0) {
+      message += " capture_dropped=" + String(capture_dropped);
+    }
+    uint32_t events_dropped = fsm.getDropped();
+    if (events_dropped > 0) {
+      message += " events_dropped=" + String(events_dropped);
     }
     logger.println(message);
     last_heartbeat_millis = millis();
@@ -360,9 +785,14 @@ void loopIdle() {
   ArduinoOTA.handle();
 
   if (settings.scale.is_changed) {
+    sampler.lock();
     setupScale();
+    sampler.flush();
+    sampler.unlock();
   }
 
+  zeroTracker.save();
+
   if (settings.wifi.reset_flag) {
     resetWifi();
   }
@@ -374,30 +804,185 @@ void loopIdle() {
     ESP.restart();
   }
 
-  if (api.isNewValueReceived()) {
-    float requested_grams = api.getNewValue();
-    logger.println("API request for " + String(requested_grams, 2) + " g");
-    target_grams = requested_grams;
-    // correction hardcoded for now
-    float correction = requested_grams > 1.5f ? 1.5f : 0.0f;
-    target_grams_corrected = requested_grams - correction;
-    // "virtually" press right button -> left cancel, right confirm
-    last_button = right;
-    button_pressed_millis = millis();
-    state = CONFIRM;
-    return;
-  }
+  checkProfile();
+  checkReset();
 
-  float grams = scale.getUnits();
+  float grams = sample.display_grams;
   if ((-0.3 < grams) && (grams < 0.3)) {
     grams = 0.0f;
   }
-  display.displayIdleLayout(grams, getConnectionIndicatorColor());
+  if (profile_banner &&
+      millis() - profile_switched_millis > profile_banner_ms) {
+    profile_banner = false;
+    display.clear();
+  }
+  if (profile_banner) {
+    char name[ProfileStore::NAME_LENGTH];
+    profiles.getName(profiles.getActive(), name);
+    display.displayString(name, VerticalAlignment::CENTER);
+  } else {
+    display.displayIdleLayout(grams, getConnectionIndicatorColor());
+  }
+
+  if (settings.scale.auto_start) {
+    checkAutoStart();
+  }
 
   if (settings.scale.screensaver_timeout_s > 0 &&
       (millis() - state_change_to_idle_millis >
        (settings.scale.screensaver_timeout_s * 1000))) {
-    state = SCREENSAVER;
+    fsm.raise({EVENT_TIMEOUT});
+  }
+}
+
+void checkAutoStart() {
+  if (!zeroTracker.hasOffset() || !stability.isStable()) {
+    return;
+  }
+  if (zeroTracker.isEmpty()) {
+    auto_start_armed = true;
+    return;
+  }
+  if (!auto_start_armed ||
+      stability.getConfidence() < settings.scale.stability_min_confidence) {
+    return;
+  }
+  // whatever was put on settled, it gets one chance to be recognized
+  auto_start_armed = false;
+
+  // weigh against the empty scale, whatever zero is applied right now
+  float grams = (stability.getMean() - zeroTracker.getOffset()) *
+                settings.scale.calibration_factor;
+  int8_t slot = signatures.match(grams);
+  if (slot < 0) {
+    return;
+  }
+  fsm.raise({EVENT_AUTO_START, none, grams, (DoseSlot)slot});
+}
+
+void restoreProfile() {
+  // the store is the authority on the active profile and its doses, the
+  // settings may just have been reset to their defaults
+  uint8_t active = profiles.getActive();
+  ProfileStore::Doses stored;
+  bool known = profiles.load(active, stored);
+  ProfileStore::Doses current = currentDoses();
+  if (settings.scale.profile == active &&
+      (!known || memcmp(&stored, &current, sizeof(stored)) == 0)) {
+    return;
+  }
+  if (known) {
+    settings.scale.target_dose_single = stored.target_single;
+    settings.scale.target_dose_double = stored.target_double;
+    settings.scale.top_up_margin_single = stored.margin_single;
+    settings.scale.top_up_margin_double = stored.margin_double;
+  }
+  settings.scale.profile = active;
+  settings.saveScaleToEEPROM();
+  logger.println("Restored profile " + String(active) + " from the store");
+}
+
+void checkProfile() {
+  // edited on the settings page or tuned after a grind
+  profiles.update(currentDoses());
+
+  uint8_t active = profiles.getActive();
+  int8_t requested = profiles.takeRequest();
+  if (requested < 0) {
+    // changed on the settings page
+    if (settings.scale.profile == active) {
+      return;
+    }
+    requested = settings.scale.profile;
+  }
+  if (requested >= ProfileStore::MAX_PROFILES || requested == active) {
+    settings.scale.profile = active;
+    return;
+  }
+  switchProfile(requested);
+}
+
+ProfileStore::Doses currentDoses() {
+  return {settings.scale.target_dose_single, settings.scale.target_dose_double,
+          settings.scale.top_up_margin_single,
+          settings.scale.top_up_margin_double};
+}
+
+void switchProfile(uint8_t index) {
+  ProfileStore::Doses current = currentDoses();
+  ProfileStore::Doses next;
+  // a profile used for the first time starts with the doses of the last one
+  bool known = profiles.load(index, next);
+  profiles.select(index, current);
+  if (known) {
+    settings.scale.target_dose_single = next.target_single;
+    settings.scale.target_dose_double = next.target_double;
+    settings.scale.top_up_margin_single = next.margin_single;
+    settings.scale.top_up_margin_double = next.margin_double;
+  }
+  settings.scale.profile = index;
+  settings.saveScaleToEEPROM();
+  beginModels();
+
+  char name[ProfileStore::NAME_LENGTH];
+  profiles.getName(index, name);
+  logger.println("Profile " + String(index) + ": " + name +
+                 (known ? "" : " (new)"));
+  profile_banner = true;
+  profile_switched_millis = millis();
+  display.clear();
+}
+
+void beginModels() {
+  // the learned models of the active bean profile
+  uint8_t index = profiles.getActive();
+  char key[16];
+  afterflow[DOSE_SINGLE].begin(
+      ProfileStore::getModelKey(key, sizeof(key), "single", index));
+  afterflow[DOSE_DOUBLE].begin(
+      ProfileStore::getModelKey(key, sizeof(key), "double", index));
+  ratePrior[DOSE_SINGLE].begin(
+      ProfileStore::getModelKey(key, sizeof(key), "single", index));
+  ratePrior[DOSE_DOUBLE].begin(
+      ProfileStore::getModelKey(key, sizeof(key), "double", index));
+  pulse.begin(ProfileStore::getModelKey(key, sizeof(key), "topup", index));
+}
+
+void checkReset() {
+  int8_t profile;
+  bool grinder;
+  if (!profiles.takeResetRequest(profile, grinder)) {
+    return;
+  }
+  if (profile >= 0) {
+    resetModels(profile);
+    logger.println("Learned models of profile " + String(profile) + " reset");
+  }
+  if (grinder) {
+    deadTime.reset();
+    signatures.reset();
+    logger.println("Dead times and portafilters reset");
+  }
+}
+
+void resetModels(uint8_t index) {
+  // through models of its own, so a profile that is not loaded can be reset
+  // too, the active one is loaded again afterwards
+  char key[16];
+  AfterflowModel afterflowModel;
+  RatePrior prior;
+  for (const char *base : {"single", "double"}) {
+    ProfileStore::getModelKey(key, sizeof(key), base, index);
+    afterflowModel.begin(key);
+    afterflowModel.reset();
+    prior.begin(key);
+    prior.reset();
+  }
+  PulseModel pulseModel;
+  pulseModel.begin(ProfileStore::getModelKey(key, sizeof(key), "topup", index));
+  pulseModel.reset();
+  if (index == profiles.getActive()) {
+    beginModels();
   }
 }
 
@@ -405,8 +990,10 @@ void loopButtonFilter() {
   auto now = millis();
 
   if (now - button_pressed_filter_millis > button_debounce_min_hold) {
-    // we held the button long enough, it's probably not noise, can move on
-    state = BUTTON_PRESSED;
+    // we held the button long enough, it's probably not noise, can move on.
+    // Debounce from here so the bounces of this press can't confirm it.
+    button_pressed_millis = now;
+    fsm.raise({EVENT_DONE});
     return;
   }
 
@@ -416,51 +1003,252 @@ void loopButtonFilter() {
   // interrupt is falling, check if button is still in correct state
   if (button_state != LOW) {
     // just noise, ignore
-    state = IDLE;
-    state_change_to_idle_millis = millis();
+    fsm.raise({EVENT_CANCEL});
   }
 }
 
-void loopButtonPressed() {
+bool isDoseButton(const Event &event) {
+  return event.pin == left || event.pin == right;
+}
+
+bool isBackButton(const Event &event) { return event.pin == back; }
+
+bool isBackDoublePress(const Event &event) {
+  unsigned long elapsed = millis() - back_pressed_millis;
+  return event.pin == back && elapsed > back_double_press_min &&
+         elapsed < back_double_press_max;
+}
+
+bool isBackBounce(const Event &event) {
+  return event.pin == back &&
+         millis() - back_pressed_millis <= back_double_press_min;
+}
+
+void pressBack(const Event &event) { back_pressed_millis = millis(); }
+
+void nextProfile(const Event &event) {
+  switchProfile((profiles.getActive() + 1) % ProfileStore::MAX_PROFILES);
+}
+
+bool isConfirmPress(const Event &event) { return event.pin == last_button; }
+
+bool isCancelPress(const Event &event) { return event.pin != back; }
+
+void pressButton(const Event &event) { button = event.pin; }
+
+void selectDose(const Event &event) {
   last_button = button;
   button_pressed_millis = millis();
+  setDose(button == left ? DOSE_SINGLE : DOSE_DOUBLE);
+  signature_session = settings.scale.batch_cups <= 1;
+
+  if (settings.scale.batch_cups > 1) {
+    // the same dose for every cup, this one is the first
+    uint8_t count = settings.scale.batch_cups;
+    if (count > DoseQueue::CAPACITY) {
+      count = DoseQueue::CAPACITY;
+    }
+    float doses[DoseQueue::CAPACITY];
+    for (uint8_t i = 0; i < count; ++i) {
+      doses[i] = target_grams;
+    }
+    float grams;
+    if (batch.set(doses, count) && batch.next(grams)) {
+      logger.println("Batch of " + String(count) + " cups");
+    }
+  }
+}
 
-  switch (button) {
-    case left:
-      target_grams = settings.scale.target_dose_single;
-      target_grams_corrected = settings.scale.target_dose_single -
-                               settings.scale.top_up_margin_single;
-      state = CONFIRM;
-      break;
-    case right:
-      target_grams = settings.scale.target_dose_double;
-      target_grams_corrected = settings.scale.target_dose_double -
-                               settings.scale.top_up_margin_double;
-      state = CONFIRM;
-      break;
-    case back:
-      state = DEBUG;
-      break;
-    default:
-      state = IDLE;
-      break;
+void setDose(DoseSlot slot) {
+  if (slot == DOSE_SINGLE) {
+    target_grams = settings.scale.target_dose_single;
+    target_grams_corrected = settings.scale.target_dose_single -
+                             settings.scale.top_up_margin_single;
+  } else {
+    target_grams = settings.scale.target_dose_double;
+    target_grams_corrected = settings.scale.target_dose_double -
+                             settings.scale.top_up_margin_double;
   }
+  dose_slot = slot;
+  margin_session = true;
+  signature_session = false;
 }
 
-void loopButtonPressedDebug() {
-  switch (button) {
-    case left:
-      state = DEBUG;
-      break;
-    case right:
-      state = DEBUG;
-      break;
-    case back:
-      state = IDLE;
-      break;
-    default:
-      state = IDLE;
-      break;
+void acceptAutoStart(const Event &event) {
+  char buffer[80];
+  sprintf(buffer, "Auto start: %.2f g portafilter, %s dose", event.grams,
+          event.slot == DOSE_SINGLE ? "single" : "double");
+  logger.println(buffer);
+  setDose(event.slot);
+  signature_session = true;
+  // the reading it was recognized on is the tare
+  auto_tare_offset = stability.getMean();
+  auto_tare_pending = true;
+}
+
+void acceptDoseRequest(const Event &event) {
+  logger.println("API request for " + String(event.grams, 2) + " g");
+  setRequestedDose(event.grams);
+  // "virtually" press right button -> left cancel, right confirm
+  last_button = right;
+  button_pressed_millis = millis();
+}
+
+void setRequestedDose(float requested_grams) {
+  target_grams = requested_grams;
+  // correction hardcoded for now
+  float correction = requested_grams > 1.5f ? 1.5f : 0.0f;
+  target_grams_corrected = requested_grams - correction;
+  // learn with the button whose dose is closer
+  dose_slot = fabsf(requested_grams - settings.scale.target_dose_single) <=
+                      fabsf(requested_grams - settings.scale.target_dose_double)
+                  ? DOSE_SINGLE
+                  : DOSE_DOUBLE;
+  margin_session = false;
+  signature_session = false;
+}
+
+bool hasBatchDose(const Event &event) { return batch.hasNext(); }
+
+// Takes the offer in the guard: the API task may cancel it at any time, so
+// checking first and taking in the action could start a withdrawn batch.
+bool takeBatchOffer(const Event &event) { return batch.take(); }
+
+void acceptBatch(const Event &event) {
+  float grams;
+  batch.next(grams);
+  logger.println("API batch of " + String(batch.getTotal()) + " doses");
+  setBatchDose(grams);
+  // "virtually" press right button -> left cancel, right confirm
+  last_button = right;
+  button_pressed_millis = millis();
+}
+
+void rejectBatch(const Event &event) {
+  const char *error = "batch withdrawn";
+  logger.println("API batch withdrawn before it started");
+  metrics.sendError(error, 0.0f, 0.0f);
+  time_t now = time(nullptr);
+  api.setLastResult({0.0f, 0.0f, 0.0f, 0, error, now > 1600000000 ? now : 0});
+}
+
+void nextBatchDose(const Event &event) {
+  float grams;
+  batch.next(grams);
+  char buffer[80];
+  sprintf(buffer, "Batch dose %u/%u: %.2f g", batch.getIndex(),
+          batch.getTotal(), grams);
+  logger.println(buffer);
+  setBatchDose(grams);
+  // the cup that was just put on is the tare
+  auto_tare_offset = stability.getMean();
+  auto_tare_pending = true;
+}
+
+void setBatchDose(float grams) {
+  // a button dose is ground with that button's margin and models
+  if (grams == settings.scale.target_dose_single) {
+    setDose(DOSE_SINGLE);
+  } else if (grams == settings.scale.target_dose_double) {
+    setDose(DOSE_DOUBLE);
+  } else {
+    setRequestedDose(grams);
+  }
+}
+
+void showScreen(Screen next) {
+  if (next == screen) {
+    return;
+  }
+  screen = next;
+  display.clear();
+}
+
+void enterIdle() {
+  if (batch.isActive()) {
+    logger.println(batch.hasNext() ? "Batch cancelled" : "Batch done");
+    batch.clear();
+  }
+  state_change_to_idle_millis = millis();
+  showScreen(SCREEN_IDLE);
+}
+
+void enterConfirm() { showScreen(SCREEN_CONFIRM); }
+
+void exitConfirm() {
+  // reset the last_button to avoid auto-confirm / -cancel in the next run
+  last_button = none;
+}
+
+void enterTare() { showScreen(SCREEN_TARE); }
+
+void enterGrinding() { showScreen(SCREEN_GRINDING); }
+
+void enterStopping() {
+  stability_wait_start_millis = millis();
+  showScreen(SCREEN_GRINDING);
+}
+
+void enterFinalize() {
+  finalize_millis = millis();
+  finalize_broadcast_done = false;
+  flow_tracking = false;
+  showScreen(SCREEN_GRINDING);
+}
+
+void enterScreensaver() { showScreen(SCREEN_SCREENSAVER); }
+
+void enterDebug() { showScreen(SCREEN_DEBUG); }
+
+void enterFault() {
+  if (grinder_is_running) {
+    grinderOff();
+  }
+  flow_tracking = false;
+  afterflow_pending = false;
+  off_delay_pending = false;
+  fault_millis = millis();
+
+  float seconds = (fault_millis - session_started_millis) / 1000.;
+  char buffer[80];
+  sprintf(buffer, "Grind aborted: %s after %.1f s at %.2f g",
+          FlowAnomalyDetector::getName(fault), seconds, sample.grams);
+  logger.println(buffer);
+
+  rawData.sendComplete();
+  graph.finalizeGraph();
+  metrics.sendError(FlowAnomalyDetector::getName(fault), seconds,
+                    sample.grams);
+  time_t now = time(nullptr);
+  api.setLastResult({target_grams, sample.grams, seconds, top_up_count,
+                     FlowAnomalyDetector::getName(fault),
+                     now > 1600000000 ? now : 0});
+  showScreen(SCREEN_FAULT);
+}
+
+void enterCupSwap() {
+  swap_low_grams = sample.grams;
+  showScreen(SCREEN_CUP_SWAP);
+}
+
+void enterEspresso() {
+  logger.println("Espresso mode");
+  startShot();
+  showScreen(SCREEN_ESPRESSO);
+}
+
+void startShot() {
+  shot.reset();
+  shot_tared = false;
+  shot_reported = false;
+}
+
+void pressShotButton(const Event &event) {
+  if (shot.getPhase() == ShotTimer::POURING) {
+    shot.stop();
+  } else {
+    // tare again, e.g. the cup was put on after the mode was entered
+    startShot();
   }
 }
 
@@ -469,49 +1257,106 @@ void loopConfirm() {
 
   if ((millis() - button_pressed_millis) > settings.scale.confirm_timeout_ms) {
     // go back to idle
-    state_change_to_idle_millis = millis();
-    state = IDLE;
-    display.refresh();
+    fsm.raise({EVENT_TIMEOUT});
   }
 }
 
 void loopTare() {
-  // we tare the scale until we get a stable reading
-  display.displayString("T", VerticalAlignment::CENTER);
-  bool success = scale.tare();
-  if (success) {
-    // averages over ring buffer were stable, move on
-    state = CONFIGURED;
+  // samples are fed to the tare engine in drainSamples(), we only wait here
+  if (auto_tare_pending) {
+    auto_tare_pending = false;
+    logger.println("Tare from auto start");
+    commitTare(auto_tare_offset);
+    return;
+  }
+  if (!tare.isRunning() && !tare.isDone()) {
+    if (baseline.isDone()) {
+      // the background baseline is good enough, no need to tare again
+      char buffer[80];
+      sprintf(buffer, "Tare from baseline: %u samples, std %.3f g",
+              baseline.getSampleCount(), baseline.getStdDev());
+      logger.println(buffer);
+      commitTare(baseline.getOffset());
+      return;
+    }
+    if (zeroTracker.isEmpty()) {
+      // nothing on the scale, the tracked zero is the tare
+      logger.println("Tare from zero tracking");
+      commitTare(zeroTracker.getOffset());
+      return;
+    }
+    tare.start();
+  }
+
+  if (!tare.isDone()) {
+    int percent = tare.getProgress() * 100;
+    display.displayString("T " + String(percent) + "%",
+                          VerticalAlignment::CENTER);
+    return;
+  }
+
+  char buffer[80];
+  sprintf(buffer, "Tare done: %u samples, std %.3f g", tare.getSampleCount(),
+          tare.getStdDev());
+  logger.println(buffer);
+
+  commitTare(tare.getOffset());
+}
+
+void commitTare(float offset) {
+  if (signature_session && zeroTracker.hasOffset()) {
+    // what was tared away is the portafilter of this dose
+    signatures.learn(dose_slot, (offset - zeroTracker.getOffset()) *
+                                    settings.scale.calibration_factor);
   }
+  sampler.setZero(offset);
+  // back to the tracked zero once the scale is empty again
+  zeroTracker.detach();
+  tare.stop();
+  baseline.stop();
+  // conversions queued before the tare still carry the old offset
+  sampler.flush();
+  tare_done_us = esp_timer_get_time();
+  fsm.raise({EVENT_DONE});
 }
 
 void loopConfigured() {
+  // wait for the first conversion taken after the tare
+  if (sample.timestamp_us <= tare_done_us) {
+    return;
+  }
+
   // reset graph & metrics target
   graph.resetGraph(target_grams);
   graph.updateGraphData(0.0f, 0.0f);
   metrics.sendTarget(target_grams);
 
-  display.displayString("T", VerticalAlignment::CENTER);
-
   // start grinder
   grinderOn();
   session_started_millis = millis();
-
-  // update display
-  display.clear();
-  display.displayString(String(target_grams, GRAMS_DIGITS) + " g",
-                        VerticalAlignment::THREE_ROW_BOTTOM);
+  anomaly.start(grinder_started_us);
 
   // initial values
-  last_grams = scale.getUnits();
-  last_grams_millis = millis();
-  last_zero_weight_millis = millis();
+  last_grams = sample.grams;
+  last_grams_us = sample.timestamp_us;
+  last_zero_weight_us = sample.timestamp_us;
+  flow_started_us = 0;
+  flow.stop();
+  flow_tracking = true;
+  grind_rate = 0.0f;
   stop_time_calculated = false;
-  calculated_stop_millis = 0;
-  grams_per_seconds_total = 0;
-  grams_per_seconds_count = 0;
+  calculated_stop_us = 0;
+  afterflow_pending = false;
+  on_delay_measured = false;
+  off_delay_pending = false;
+  top_up_count = 0;
+  approach_active = settings.scale.approach_fraction > 0.0f;
+  if (approach_active) {
+    // the approach replaces the margin
+    margin_session = false;
+  }
 
-  state = RUNNING;
+  fsm.raise({EVENT_DONE});
 }
 
 void loopRunning() {
@@ -519,125 +1364,174 @@ void loopRunning() {
 
   if (now - session_started_millis > settings.scale.grinding_timeout_ms) {
     // timeout - no top up
-    state = STOPPING;
+    fsm.raise({EVENT_TIMEOUT});
+    return;
+  }
+
+  // give up early on an empty hopper or a clog instead of running dry
+  bool flowing = flow.isRunning();
+  fault = anomaly.update(
+      sample.timestamp_us, flowing, flowing ? flow.getRate() : 0.0f,
+      flowing && flow.getRateStdDev() < settings.scale.rate_max_std);
+  if (fault != FlowAnomalyDetector::NONE) {
+    fsm.raise({EVENT_FAULT});
     return;
   }
 
-  float grams = scale.getUnits();
+  float grams = sample.grams;
 
   float time = (now - session_started_millis) / 1000.;
 
-  // update graph + metrics
-  graph.updateGraphData(time, grams);
-  metrics.sendProgress(time, grams);
+  // update graph + metrics from the smooth stream
+  if (display_sample_ready) {
+    graph.updateGraphData(time, sample.display_grams);
+    metrics.sendProgress(time, sample.display_grams);
+  }
 
   // log raw ADC data during grinding
-  bool isStable;
-  int32_t rawValue = scale.getRaw(isStable);
-  rawData.sendRawData(rawValue, grams, now - session_started_millis, isStable);
+  rawData.sendRawData(sample.raw, grams, now - session_started_millis,
+                      stability.isStable());
 
   display.displayGrindingLayout(grams, target_grams, time, ST7735_WHITE,
                                 ST7735_WHITE, ST7735_WHITE,
                                 getConnectionIndicatorColor());
 
   // wait until something is happening
-  if (grams < 1) {
-    return;
-  }
-
-  // calculate weight increase
-  float delta_grams = grams - last_grams;
-  float delta_millis = now - last_grams_millis;
-  if (delta_grams < 0.2 && delta_millis < 500) {
+  if (grams < 1 || !flow.isRunning()) {
     return;
   }
 
-  // calculate rate
-  float rate = 1000. * delta_grams / delta_millis;
-  if (rate < 0) {
-    return;
-  }
-
-  // Track last time weight was < 0.1g
-  if (grams < 0.1) {
-    last_zero_weight_millis = now;
-  }
-
-  // Calculate stop time if not already done
-  if (!stop_time_calculated) {
-    float threshold_weight =
-        target_grams * settings.scale.rate_calculation_percentage;
-    if (grams >= threshold_weight) {
-      // We subtract 100ms to account for the ADC lag / sampling interval bias
-      // last_zero_weight_millis is the timestamp of the last sample < 0.1g,
-      // so the actual flow started somewhere between that and the next sample.
-      float duration_since_start_of_flow =
-          (now - last_zero_weight_millis - 100) / 1000.0;
-      // Avoid division by zero or very small numbers
-      if (duration_since_start_of_flow < 0.1)
-        duration_since_start_of_flow = 0.1;
-
-      float calculated_rate = grams / duration_since_start_of_flow;
-
-      if (calculated_rate < settings.scale.rate_min_valid ||
-          calculated_rate > settings.scale.rate_max_valid) {
-        calculated_rate = settings.scale.rate_default;
+  // Commit to a stop time as soon as the flow estimate has converged, at the
+  // latest when rate_calculation_percentage of the dose is reached. With a
+  // learned rate prior a provisional stop time is scheduled from the first
+  // grams on. Until the grinder is stopped the stop time is refined with
+  // every new estimate.
+  const RatePrior &prior = ratePrior[dose_slot];
+  float fallback_rate = prior.getRate(settings.scale.rate_default);
+  float rate = flow.getRate();
+  bool rate_valid = rate >= settings.scale.rate_min_valid &&
+                    rate <= settings.scale.rate_max_valid;
+  bool converged =
+      rate_valid && flow.getRateStdDev() < settings.scale.rate_max_std;
+  float threshold_weight =
+      target_grams * settings.scale.rate_calculation_percentage;
+  if (converged || prior.isTrained() || grams >= threshold_weight) {
+    float stop_rate = rate_valid ? rate : fallback_rate;
+
+    const AfterflowModel &model = afterflow[dose_slot];
+    float run_duration;
+    bool dead_time_stop = false;
+    if (approach_active) {
+      // leave the last part of the dose to the approach pulses, there is no
+      // margin so the grounds of the off delay are aimed for here
+      float aim = target_grams * (1.0f - settings.scale.approach_fraction);
+      float elapsed = (flow.getTimestamp() - grinder_started_us) / 1e6f;
+      run_duration =
+          model.isTrained()
+              ? model.solveRunDuration(aim - flow.getWeight(), stop_rate,
+                                       elapsed)
+              : (aim - flow.getWeight()) / stop_rate - deadTime.getOffDelay();
+    } else if (model.isTrained()) {
+      // stop where the learned afterflow fills up to the target, aiming a bit
+      // low as an overshoot can't be undone
+      float aim = target_grams - 0.5f * model.getResidualStdDev();
+      float elapsed = (flow.getTimestamp() - grinder_started_us) / 1e6f;
+      run_duration = model.solveRunDuration(aim - flow.getWeight(), stop_rate,
+                                            elapsed);
+      // the margin played no part in this stop
+      margin_session = false;
+    } else {
+      // target_grams_corrected is (target_grams - topup_margin). Both the
+      // margin and the grounds still in flight for the off delay are what
+      // lands after the relay is switched off, so hold back the larger of
+      // the two and not their sum.
+      float margin = target_grams - target_grams_corrected;
+      float in_flight = stop_rate * deadTime.getOffDelay();
+      if (in_flight > margin) {
+        margin = in_flight;
+        // the measured dead time stopped this run, not the margin
+        margin_session = false;
+        dead_time_stop = true;
       }
+      // with a valid rate the estimator predicts when it reaches the aim
+      float aim = target_grams - margin;
+      run_duration =
+          rate_valid ? (flow.predictTimeOf(aim) - flow.getTimestamp()) / 1e6f
+                     : (aim - flow.getWeight()) / stop_rate;
+    }
 
-      // target_grams_corrected is (target_grams - topup_margin)
-      float run_duration = target_grams_corrected / calculated_rate;
-
-      // Safety check for run_duration to prevent overflow or excessively long
-      // runs
-      if (run_duration > 60.0f) run_duration = 60.0f;
+    // Safety check for run_duration to prevent overflow or excessively long
+    // runs
+    if (run_duration > 60.0f) run_duration = 60.0f;
 
-      calculated_stop_millis =
-          grinder_started_millis + (unsigned long)(run_duration * 1000);
-      stop_time_calculated = true;
+    calculated_stop_us =
+        flow.getTimestamp() + (int64_t)(run_duration * 1000000);
+    grind_rate = stop_rate;
+    // switched by the timer, not when the loop gets around to it
+    relay.schedule(false, calculated_stop_us);
 
+    if (!stop_time_calculated) {
       char buffer[100];
-      sprintf(buffer, "Rate calc: %.2f g/s, Stop at: %lu", calculated_rate,
-              calculated_stop_millis);
+      unsigned long stop_after_ms =
+          (calculated_stop_us - grinder_started_us) / 1000;
+      const char *stop_mode = "margin";
+      if (approach_active) {
+        stop_mode = "approach";
+      } else if (model.isTrained()) {
+        stop_mode = "afterflow model";
+      } else if (dead_time_stop) {
+        stop_mode = "dead time";
+      }
+      sprintf(buffer, "Rate calc: %.2f +- %.2f g/s, Stop at: %lu ms (%s%s)",
+              stop_rate, flow.getRateStdDev(), stop_after_ms, stop_mode,
+              converged ? "" : ", provisional");
       logger.println(buffer);
     }
+    stop_time_calculated = true;
   }
 
   // Check if we should stop based on calculated time and weight
   // Weight only serves as a fallback, which is why we use target_grams, not
   // target_grams_corrected
-  if ((grams > target_grams) ||
-      (stop_time_calculated && now >= calculated_stop_millis)) {
+  if ((grams > target_grams) || (stop_time_calculated && !relay.isOn())) {
     grinderOff();
     logger.println("Calculated stop time reached");
-    state = TOPUP;
+    if (!stop_time_calculated) {
+      grind_rate = rate_valid ? rate : fallback_rate;
+    }
+    if (converged) {
+      ratePrior[dose_slot].learn(rate);
+    }
+    // what was in the cup at the switch, the estimate lags behind the relay
+    int64_t off_us = grinder_stopped_us;
+    afterflow_off_grams =
+        flow.getWeight() + rate * (off_us - flow.getTimestamp()) / 1e6f;
+    afterflow_off_rate = rate;
+    afterflow_runtime_s = (off_us - grinder_started_us) / 1e6f;
+    afterflow_pending = rate_valid;
+    off_delay_pending = true;
+    off_peak_grams = grams;
+    off_last_rise_us = grinder_stopped_us;
+    approach_started_millis = now;
+    fsm.raise({EVENT_DONE});
     return;
   }
 
-  // update last values with current ones
-  last_grams = grams;
-  last_grams_millis = now;
-
-  // update the values for average calculation
-  if (rate > 0.1) {
-    grams_per_seconds_total += rate;
-    ++grams_per_seconds_count;
-  }
-
-  // calculate average rate
-  float avg_rate = (grams_per_seconds_count > 0)
-                       ? grams_per_seconds_total / grams_per_seconds_count
-                       : 0;
-
-  if (!(avg_rate > 0)) {
+  // only log every 0.2 g or 500 ms
+  float delta_grams = grams - last_grams;
+  float delta_millis = (sample.timestamp_us - last_grams_us) / 1000.0f;
+  if (delta_grams < 0.2 && delta_millis < 500) {
     return;
   }
+  last_grams = grams;
+  last_grams_us = sample.timestamp_us;
 
   // send formatted log message
   char buffer[130];
   sprintf(buffer,
-          "TIME %5.2f s | WEIGHT %+5.2f g | RATE %+3.2f g/s | RATE (AVG) "
-          "%+3.2f g/s",
-          time, grams, rate, avg_rate);
+          "TIME %5.2f s | WEIGHT %+5.2f g | RATE %+3.2f g/s | RATE (STD) "
+          "%3.2f g/s",
+          time, flow.getWeight(), rate, flow.getRateStdDev());
   logger.println(buffer);
 
   // Display is handled by displayGrindingLayout above
@@ -648,75 +1542,119 @@ void loopTopUp() {
   // wait to stabilize
   // top up if necessary, based on weight calculation
   auto now = millis();
-  float grams = scale.getUnits();
+  float grams = sample.grams;
   float time = (now - session_started_millis) / 1000.;
 
   display.displayGrindingLayout(grams, target_grams, time, ST7735_CYAN,
                                 ST7735_WHITE, ST7735_WHITE,
                                 getConnectionIndicatorColor());
 
-  graph.updateGraphData(time, grams);
+  if (display_sample_ready) {
+    graph.updateGraphData(time, sample.display_grams);
+  }
 
-  bool isStable;
-  int32_t rawValue = scale.getRaw(isStable);
-  rawData.sendRawData(rawValue, grams, now - session_started_millis, isStable);
+  rawData.sendRawData(sample.raw, grams, now - session_started_millis,
+                      stability.isStable());
 
   if (!grinder_is_running) {
     unsigned long wait_time = now - last_top_up_millis;
 
     float delta_grams = grams - grams_on_grinder_on;
     bool enough_weight = delta_grams >= settings.scale.min_topup_grams;
-    bool enough_time = wait_time >= settings.scale.topup_timeout_ms;
+    // a confidently settled signal does not need to wait for the timeout
+    bool enough_time = wait_time >= settings.scale.topup_timeout_ms ||
+                       stability.getConfidence() >=
+                           settings.scale.stability_min_confidence;
     bool enough_interval =
         (now - grinder_started_millis) >= settings.scale.min_topup_interval_ms;
 
     // We always need a stable reading to make a decision
-    if (!isStable) {
+    if (!stability.isStable()) {
       return;
     }
 
     // If we haven't waited the minimum time yet, we can only proceed early if
-    // we have detected enough weight change AND respected the minimum interval
-    if (!enough_time) {
+    // we have detected enough weight change AND respected the minimum interval.
+    // The approach goes on as soon as the weight is stable.
+    if (!enough_time && !approach_active) {
       if (!enough_weight || !enough_interval) {
         return;
       }
     }
 
-    metrics.sendTopUp(grinder_runtime_millis, delta_grams);
+    if (afterflow_pending) {
+      afterflow_pending = false;
+      learnAfterflow(grams);
+    }
+    if (off_delay_pending) {
+      off_delay_pending = false;
+      learnDeadTime();
+    }
+
+    if (run_result_pending) {
+      run_result_pending = false;
+      metrics.sendTopUp(grinder_runtime_millis, delta_grams);
+      if (top_up_count > 0) {
+        // the last run was a top-up pulse, not the main run
+        learnPulse(grinder_runtime_millis / 1000.0f, delta_grams);
+        fault = anomaly.addPulse(delta_grams);
+        if (fault != FlowAnomalyDetector::NONE) {
+          fsm.raise({EVENT_FAULT});
+          return;
+        }
+      }
+    }
 
-    if (grams >= target_grams - 0.08) {
+    float tolerance =
+        approach_active ? settings.scale.approach_tolerance : 0.08f;
+    if (grams >= target_grams - tolerance) {
       logger.println("Target weight reached - stopping");
       // close enough to target weight
-      state = STOPPING;
+      fsm.raise({EVENT_DONE});
+      return;
+    }
+
+    if (approach_active &&
+        now - approach_started_millis > settings.scale.approach_budget_ms) {
+      logger.println("Approach time budget used up - stopping");
+      fsm.raise({EVENT_DONE});
       return;
     }
 
     // if we are here, we haven't reached target yet
     // check if we are allowed to top up again
-    if (!enough_interval) {
+    if (!enough_interval && !approach_active) {
       return;
     }
 
-    // calculate next top off time based on avg_rate
-    float avg_rate = (grams_per_seconds_count > 0)
-                         ? grams_per_seconds_total / grams_per_seconds_count
-                         : 0.1;
-    if (!(avg_rate > 0)) {
-      logger.println("Zero avg_rate?");
-      state = STOPPING;
+    // calculate next top off time based on the flow rate of the main run
+    if (!(grind_rate > 0)) {
+      logger.println("Zero grind_rate?");
+      fsm.raise({EVENT_DONE});
       return;
     }
-    // calculate how long we should run, only allowing a window of values
-    float top_up_seconds = (target_grams - grams) / avg_rate;
-    float min_seconds = settings.scale.min_topup_runtime_ms / 1000.0f;
+    // calculate how long we should run from the learned pulse response, only
+    // allowing a window of values. Approach pulses aim at the middle of the
+    // tolerance and may be shorter than a regular top-up.
+    float missing = target_grams - grams;
+    if (approach_active) {
+      missing -= 0.5f * settings.scale.approach_tolerance;
+    }
+    float top_up_seconds =
+        pulse.solveDuration(missing, grind_rate,
+                            deadTime.getOnDelay() - deadTime.getOffDelay());
+    float min_seconds = approach_active
+                            ? approach_min_pulse_s
+                            : settings.scale.min_topup_runtime_ms / 1000.0f;
     top_up_seconds =
         top_up_seconds < min_seconds ? min_seconds : top_up_seconds;
     top_up_seconds = top_up_seconds > 1.3f ? 1.3f : top_up_seconds;
-    top_up_stop_millis = now + 1000. * top_up_seconds;
-    logger.println("Top up for " + String(top_up_seconds, TIME_DIGITS) + " s");
+    logger.println("Top up for " + String(top_up_seconds, 2) + " s");
+    ++top_up_count;
     grinderOn();
-  } else if (grinder_is_running && (now > top_up_stop_millis)) {
+    relay.schedule(false,
+                   grinder_started_us + (int64_t)(top_up_seconds * 1000000));
+  } else if (grinder_is_running && !relay.isOn()) {
     grinderOff();
     logger.println("Top up done - waiting for settle");
     last_top_up_millis = now;
@@ -731,24 +1669,39 @@ void loopStopping() {
   }
 
   auto now = millis();
-  float grams = scale.getUnits();
+  float grams = sample.grams;
   float time = (now - session_started_millis) / 1000.;
 
   display.displayGrindingLayout(grams, target_grams, time, ST7735_CYAN,
                                 ST7735_WHITE, ST7735_WHITE,
                                 getConnectionIndicatorColor());
 
-  bool isStable;
-  int32_t rawValue = scale.getRaw(isStable);
-  rawData.sendRawData(rawValue, grams, now - session_started_millis, isStable);
+  rawData.sendRawData(sample.raw, grams, now - session_started_millis,
+                      stability.isStable());
 
   unsigned long wait_time = now - stability_wait_start_millis;
 
-  // Check for stability or enforce maximum wait time
-  if (!isStable && wait_time < settings.scale.stability_max_wait_ms) {
+  // Move on as soon as the signal is statistically settled: right away with
+  // high confidence, otherwise once it has stayed stable for the minimum
+  // wait, timed on the samples. Enforce the maximum wait time in any case.
+  int64_t stable_us = stability.isStable()
+                          ? sample.timestamp_us - stability.getStableSinceUs()
+                          : 0;
+  bool settled = stability.getConfidence() >=
+                     settings.scale.stability_min_confidence ||
+                 (stability.isStable() &&
+                  stable_us >=
+                      (int64_t)settings.scale.stability_min_wait_ms * 1000);
+  if (!settled && wait_time < settings.scale.stability_max_wait_ms) {
     logger.println("Waiting to stabilize");
     return;
   }
+  if (settled) {
+    char settle_buffer[80];
+    sprintf(settle_buffer, "Settled after %lu ms (confidence %.2f)", wait_time,
+            stability.getConfidence());
+    logger.println(settle_buffer);
+  }
 
   char buffer[80];
   sprintf(buffer,
@@ -759,11 +1712,9 @@ void loopStopping() {
   time = (now - session_started_millis) / 1000.;
   graph.updateGraphData(time, grams);
 
-  finalize_millis = millis();
   finalize_grams = grams;
   finalize_time = time;
-  finalize_broadcast_done = false;
-  state = FINALIZE;
+  fsm.raise({EVENT_DONE});
 }
 
 void loopFinalize() {
@@ -774,10 +1725,9 @@ void loopFinalize() {
     // send finalize events only once to avoid flooding websockets / heap
 
     // Send final raw data point
-    bool isStable;
-    int32_t rawValue = scale.getRaw(isStable);
     unsigned long timestamp = millis() - session_started_millis;
-    rawData.sendRawData(rawValue, finalize_grams, timestamp, isStable);
+    rawData.sendRawData(sample.raw, finalize_grams, timestamp,
+                        stability.isStable());
 
     // Send completion event
     rawData.sendComplete();
@@ -785,20 +1735,38 @@ void loopFinalize() {
     // Send other finalize events
     graph.finalizeGraph();
     metrics.sendFinalize(finalize_time, finalize_grams);
+    if (batch.isActive()) {
+      metrics.sendBatchResult(batch.getIndex(), batch.getTotal(),
+                              target_grams, finalize_time, finalize_grams);
+    }
     finalize_broadcast_done = true;
 
+    recordSession();
+
     // Save timestamp
     time_t now = time(nullptr);
-    if (now > 1600000000) {
+    bool time_valid = now > 1600000000;
+    if (time_valid) {
       settings.scale.last_coffee_timestamp = now;
       settings.saveScaleToEEPROM();
     }
+
+    // stays available after the result screen is gone
+    api.setLastResult({target_grams, finalize_grams, finalize_time,
+                       top_up_count, nullptr, time_valid ? now : 0});
+  }
+
+  // lifting the cup ends the result screen right away, the next dose does
+  // not have to wait for the timeout
+  if (settings.scale.cup_removal_step > 0 &&
+      sample.grams < finalize_grams - settings.scale.cup_removal_step) {
+    logger.println("Cup removed");
+    fsm.raise({EVENT_CANCEL});
+    return;
   }
 
   if (millis() - finalize_millis > settings.scale.finalize_timeout_ms) {
-    display.clear();
-    state_change_to_idle_millis = millis();
-    state = IDLE;
+    fsm.raise({EVENT_TIMEOUT});
   }
 }
 
@@ -806,14 +1774,14 @@ void loopDebug() {
   IPAddress ip = WiFi.localIP();
   display.displayString(ip.toString(), VerticalAlignment::TWO_ROW_TOP);
 
-  bool isStable;
-  auto raw = scale.getRaw(isStable);
+  bool isStable = stability.isStable();
+  auto raw = sample.raw;
 
   if (millis() - debug_last_print_millis > 1000) {
     char logger_buffer[100];
     sprintf(logger_buffer, "Cal: %f - Raw: %ld %s - Grams: %f",
             settings.scale.calibration_factor, raw, isStable ? "S" : "P",
-            scale.getUnits());
+            sample.grams);
     logger.println(logger_buffer);
     char buffer[12];
     sprintf(buffer, "%d %s", raw, isStable ? "S" : "P");
@@ -822,19 +1790,113 @@ void loopDebug() {
   }
 }
 
+void loopFault() {
+  display.setTextColor({ST7735_RED, ST7735_BLACK});
+  const char *text = fault == FlowAnomalyDetector::STALL ? "CLOG?" : "EMPTY?";
+  display.displayString(text, VerticalAlignment::TWO_ROW_TOP);
+  display.setTextColor({ST7735_WHITE, ST7735_BLACK});
+  display.displayString(String(sample.grams, GRAMS_DIGITS) + " g",
+                        VerticalAlignment::TWO_ROW_BOTTOM);
+
+  if (millis() - fault_millis > settings.scale.finalize_timeout_ms) {
+    fsm.raise({EVENT_TIMEOUT});
+  }
+}
+
+void recordSession() {
+  float &margin = dose_slot == DOSE_SINGLE
+                      ? settings.scale.top_up_margin_single
+                      : settings.scale.top_up_margin_double;
+  bool tune = margin_session && settings.scale.auto_tune_margins;
+  float next = tuner.record(dose_slot, profiles.getActive(), target_grams,
+                            finalize_grams, top_up_count, margin, tune);
+  if (next == margin) {
+    return;
+  }
+
+  char buffer[80];
+  sprintf(buffer, "Top up margin %.2f g -> %.2f g (%u top-ups, %+.2f g)",
+          margin, next, top_up_count, finalize_grams - target_grams);
+  logger.println(buffer);
+  margin = next;
+  settings.saveScaleToEEPROM();
+}
+
+void learnAfterflow(float settled_grams) {
+  AfterflowModel &model = afterflow[dose_slot];
+  float observed = settled_grams - afterflow_off_grams;
+  float predicted = model.predict(afterflow_off_rate, afterflow_runtime_s);
+  bool accepted =
+      model.learn(afterflow_off_rate, afterflow_runtime_s, observed);
+
+  char buffer[120];
+  sprintf(buffer,
+          "Afterflow %.2f g (predicted %.2f g) at %.2f g/s after %.1f s%s, "
+          "%u sessions",
+          observed, predicted, afterflow_off_rate, afterflow_runtime_s,
+          accepted ? "" : " rejected", model.getSessions());
+  logger.println(buffer);
+}
+
+void learnDeadTime() {
+  float off_delay_s = (off_last_rise_us - grinder_stopped_us) / 1e6f;
+  bool accepted = deadTime.addOffDelay(off_delay_s);
+
+  char buffer[120];
+  sprintf(buffer,
+          "Dead time on %.0f ms, off %.0f ms%s (estimates %.0f / %.0f ms)",
+          on_delay_s * 1000, off_delay_s * 1000, accepted ? "" : " rejected",
+          deadTime.getOnDelay() * 1000, deadTime.getOffDelay() * 1000);
+  logger.println(buffer);
+  metrics.sendDeadTime(on_delay_measured ? on_delay_s : 0.0f, off_delay_s,
+                       deadTime.getOnDelay(), deadTime.getOffDelay());
+}
+
+void learnPulse(float seconds, float grams) {
+  float predicted = pulse.predict(seconds, grind_rate,
+                                  deadTime.getOnDelay() -
+                                      deadTime.getOffDelay());
+  bool accepted = pulse.learn(seconds, grams);
+
+  char buffer[100];
+  sprintf(buffer, "Top up pulse %.2f s: %.2f g (predicted %.2f g)%s, %u pulses",
+          seconds, grams, predicted, accepted ? "" : " rejected",
+          pulse.getPulses());
+  logger.println(buffer);
+}
+
 void grinderOn() {
-  grams_on_grinder_on = scale.getUnits();
-  digitalWrite(GRINDER_RELAY_PIN, HIGH);
+  grams_on_grinder_on = sample.grams;
+  relay.set(true);
+  // only judge stability on samples taken after the switch
+  stability.reset();
   logger.println("Grinder started");
   grinder_started_millis = millis();
+  grinder_started_us = relay.getSwitchedUs();
   grinder_is_running = true;
+  run_result_pending = false;
 }
 void grinderOff() {
-  digitalWrite(GRINDER_RELAY_PIN, LOW);
-  logger.println("Grinder stopped");
-  grinder_stopped_millis = millis();
-  grinder_runtime_millis = grinder_stopped_millis - grinder_started_millis;
+  // a scheduled stop has switched the relay already, only catch up here
+  bool scheduled = !relay.isOn() && grinder_is_running;
+  if (!scheduled) {
+    relay.set(false);
+  }
+  stability.reset();
+  if (scheduled) {
+    char buffer[60];
+    sprintf(buffer, "Grinder stopped (scheduled, %ld us late)",
+            (long)relay.getLateUs());
+    logger.println(buffer);
+  } else {
+    logger.println("Grinder stopped");
+  }
+  grinder_stopped_us = relay.getSwitchedUs();
+  grinder_stopped_millis =
+      millis() - (esp_timer_get_time() - grinder_stopped_us) / 1000;
+  grinder_runtime_millis = (grinder_stopped_us - grinder_started_us) / 1000;
   grinder_is_running = false;
+  run_result_pending = true;
 }
 
 void setupDisplay() {
@@ -905,16 +1967,9 @@ void loopScreensaver() {
   ArduinoOTA.handle();
 
   // Exit on weight change
-  float grams = scale.getUnits();
+  float grams = sample.display_grams;
   if (abs(grams) > 0.5) {
-    state = IDLE;
-    state_change_to_idle_millis = millis();
-    return;
-  }
-
-  // Also check if API received new value
-  if (api.isNewValueReceived()) {
-    state = IDLE;
+    fsm.raise({EVENT_CANCEL});
     return;
   }
 
@@ -951,3 +2006,79 @@ void loopScreensaver() {
 
   display.displayScreensaver(hours, minutes, seconds, millis_part);
 }
+
+void loopCupSwap() {
+  if (!batch.hasNext()) {
+    // cancelled from the API
+    fsm.raise({EVENT_CANCEL});
+    return;
+  }
+  display.displayString("CUP " + String(batch.getIndex() + 1) + "/" +
+                            String(batch.getTotal()),
+                        VerticalAlignment::CENTER);
+
+  if (sample.grams < swap_low_grams) {
+    swap_low_grams = sample.grams;
+  }
+  // the full cup was lifted and a new one settled on the scale
+  if (stability.isStable() &&
+      stability.getConfidence() >= settings.scale.stability_min_confidence &&
+      sample.grams > swap_low_grams + cup_swap_step_g) {
+    logger.println("Cup swapped");
+    fsm.raise({EVENT_DONE});
+  }
+}
+
+void loopEspresso() {
+  if (!shot_tared) {
+    display.displayString("TARE", VerticalAlignment::CENTER);
+    if (!stability.isStable() ||
+        stability.getConfidence() < settings.scale.stability_min_confidence) {
+      return;
+    }
+    sampler.setZero(stability.getMean());
+    // back to the tracked zero once the scale is empty again
+    zeroTracker.detach();
+    sampler.flush();
+    tare_done_us = esp_timer_get_time();
+    shot_tared = true;
+    display.clear();
+
+    graph.resetGraph(settings.scale.espresso_yield);
+    graph.updateShotData(0.0f, 0.0f, 0.0f);
+    metrics.sendTarget(settings.scale.espresso_yield);
+    logger.println("Espresso: waiting for the first drip");
+    return;
+  }
+
+  // every conversion after the tare exactly once
+  if (sample.timestamp_us > tare_done_us &&
+      sample.timestamp_us > shot_sample_us) {
+    shot_sample_us = sample.timestamp_us;
+    if (shot.update(sample.grams, sample.timestamp_us) ==
+        ShotTimer::POURING) {
+      graph.updateShotData(shot.getSeconds(), sample.grams, shot.getFlow());
+      metrics.sendShot(shot.getSeconds(), sample.grams, shot.getFlow());
+    }
+  }
+
+  bool done = shot.getPhase() == ShotTimer::DONE;
+  if (done && !shot_reported) {
+    const ShotTimer::Summary &summary = shot.getSummary();
+    char buffer[100];
+    sprintf(buffer, "Shot: %.1f s, %.2f g, %.2f g/s average, %.2f g/s peak",
+            summary.seconds, summary.weight, summary.averageFlow,
+            summary.peakFlow);
+    logger.println(buffer);
+    graph.finalizeGraph();
+    metrics.sendShotSummary(summary.seconds, summary.weight,
+                            summary.averageFlow, summary.peakFlow);
+    shot_reported = true;
+  }
+
+  display.displayGrindingLayout(
+      done ? shot.getSummary().weight : sample.grams,
+      settings.scale.espresso_yield, shot.getSeconds(),
+      done ? ST7735_GREEN : ST7735_WHITE, ST7735_WHITE, ST7735_WHITE,
+      getConnectionIndicatorColor());
+}
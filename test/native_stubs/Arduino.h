@@ -0,0 +1,18 @@
+#pragma once
+// Just enough of Arduino.h for the hardware independent libraries to build
+// in [env:native]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+template <typename T, typename L, typename H>
+T constrain(T x, L low, H high) {
+  return x < low ? low : (x > high ? high : x);
+}
+
+// time stands still in the tests
+inline unsigned long millis() { return 0; }
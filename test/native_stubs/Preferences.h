@@ -0,0 +1,71 @@
+#pragma once
+// NVS for [env:native]: a map that lives as long as the test process
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+
+class Preferences {
+ public:
+  bool begin(const char *name, bool readOnly = false) {
+    _namespace = name;
+    return true;
+  }
+  void end() {}
+
+  size_t getBytes(const char *key, void *buf, size_t maxLen) {
+    auto it = storage().find(_namespace + "/" + key);
+    if (it == storage().end()) {
+      return 0;
+    }
+    size_t len = it->second.size() < maxLen ? it->second.size() : maxLen;
+    memcpy(buf, it->second.data(), len);
+    return len;
+  }
+
+  size_t putBytes(const char *key, const void *value, size_t len) {
+    storage()[_namespace + "/" + key] =
+        std::string(static_cast<const char *>(value), len);
+    return len;
+  }
+
+  bool isKey(const char *key) {
+    return storage().count(_namespace + "/" + key) > 0;
+  }
+
+  float getFloat(const char *key, float defaultValue = 0) {
+    return get(key, defaultValue);
+  }
+  size_t putFloat(const char *key, float value) {
+    return putBytes(key, &value, sizeof(value));
+  }
+
+  int32_t getInt(const char *key, int32_t defaultValue = 0) {
+    return get(key, defaultValue);
+  }
+  size_t putInt(const char *key, int32_t value) {
+    return putBytes(key, &value, sizeof(value));
+  }
+
+  // Forget every namespace, for a fresh start between tests
+  static void wipe() { storage().clear(); }
+
+ private:
+  static std::map<std::string, std::string> &storage() {
+    static std::map<std::string, std::string> values;
+    return values;
+  }
+
+  template <typename T>
+  T get(const char *key, T defaultValue) {
+    T value;
+    return getBytes(key, &value, sizeof(value)) == sizeof(value)
+               ? value
+               : defaultValue;
+  }
+
+  std::string _namespace;
+};
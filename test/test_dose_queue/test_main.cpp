@@ -0,0 +1,111 @@
+#include <DoseQueue.h>
+#include <unity.h>
+
+static const float DOSES[] = {18.0f, 9.0f, 16.5f};
+
+void setUp() {}
+void tearDown() {}
+
+void test_doses_come_out_in_order() {
+  DoseQueue queue;
+  TEST_ASSERT_TRUE(queue.set(DOSES, 3));
+  TEST_ASSERT_TRUE(queue.isActive());
+  TEST_ASSERT_EQUAL_UINT8(0, queue.getIndex());
+  float grams;
+  for (uint8_t i = 0; i < 3; ++i) {
+    TEST_ASSERT_TRUE(queue.hasNext());
+    TEST_ASSERT_TRUE(queue.next(grams));
+    TEST_ASSERT_EQUAL_FLOAT(DOSES[i], grams);
+    TEST_ASSERT_EQUAL_UINT8(i + 1, queue.getIndex());
+  }
+  TEST_ASSERT_FALSE(queue.hasNext());
+  TEST_ASSERT_FALSE(queue.next(grams));
+  // the last dose stays the current one until the batch is cleared
+  TEST_ASSERT_TRUE(queue.isActive());
+  TEST_ASSERT_EQUAL_UINT8(3, queue.getTotal());
+}
+
+void test_refuses_invalid_counts() {
+  float doses[DoseQueue::CAPACITY + 1] = {};
+  DoseQueue queue;
+  TEST_ASSERT_FALSE(queue.set(doses, 0));
+  TEST_ASSERT_FALSE(queue.set(doses, DoseQueue::CAPACITY + 1));
+  TEST_ASSERT_FALSE(queue.offer(doses, 0));
+  TEST_ASSERT_FALSE(queue.offer(doses, DoseQueue::CAPACITY + 1));
+  TEST_ASSERT_FALSE(queue.isActive());
+  TEST_ASSERT_TRUE(queue.set(doses, DoseQueue::CAPACITY));
+}
+
+void test_refuses_a_second_batch() {
+  DoseQueue queue;
+  TEST_ASSERT_TRUE(queue.set(DOSES, 3));
+  TEST_ASSERT_FALSE(queue.set(DOSES, 1));
+  TEST_ASSERT_FALSE(queue.offer(DOSES, 1));
+  TEST_ASSERT_FALSE(queue.hasOffer());
+  TEST_ASSERT_EQUAL_UINT8(3, queue.getTotal());
+}
+
+void test_offer_starts_only_when_taken() {
+  DoseQueue queue;
+  TEST_ASSERT_TRUE(queue.offer(DOSES, 2));
+  TEST_ASSERT_TRUE(queue.hasOffer());
+  TEST_ASSERT_FALSE(queue.isActive());
+  TEST_ASSERT_FALSE(queue.hasNext());
+
+  TEST_ASSERT_TRUE(queue.take());
+  TEST_ASSERT_FALSE(queue.hasOffer());
+  TEST_ASSERT_TRUE(queue.isActive());
+  TEST_ASSERT_EQUAL_UINT8(2, queue.getTotal());
+  float grams;
+  TEST_ASSERT_TRUE(queue.next(grams));
+  TEST_ASSERT_EQUAL_FLOAT(DOSES[0], grams);
+  TEST_ASSERT_FALSE(queue.take());
+}
+
+void test_newer_offer_replaces_one_not_taken() {
+  DoseQueue queue;
+  TEST_ASSERT_TRUE(queue.offer(DOSES, 3));
+  TEST_ASSERT_TRUE(queue.offer(DOSES + 1, 1));
+  TEST_ASSERT_TRUE(queue.take());
+  TEST_ASSERT_EQUAL_UINT8(1, queue.getTotal());
+  float grams;
+  TEST_ASSERT_TRUE(queue.next(grams));
+  TEST_ASSERT_EQUAL_FLOAT(DOSES[1], grams);
+}
+
+void test_offer_is_dropped_if_a_batch_started_first() {
+  DoseQueue queue;
+  TEST_ASSERT_TRUE(queue.offer(DOSES, 3));
+  // a dose button started its own batch before the offer was taken
+  TEST_ASSERT_TRUE(queue.set(DOSES + 2, 1));
+  TEST_ASSERT_FALSE(queue.take());
+  TEST_ASSERT_FALSE(queue.hasOffer());
+  TEST_ASSERT_EQUAL_UINT8(1, queue.getTotal());
+}
+
+void test_clear_ends_batch_and_offer() {
+  DoseQueue queue;
+  TEST_ASSERT_TRUE(queue.offer(DOSES, 3));
+  queue.clear();
+  TEST_ASSERT_FALSE(queue.hasOffer());
+  TEST_ASSERT_FALSE(queue.take());
+
+  TEST_ASSERT_TRUE(queue.set(DOSES, 3));
+  queue.clear();
+  TEST_ASSERT_FALSE(queue.isActive());
+  TEST_ASSERT_FALSE(queue.hasNext());
+  TEST_ASSERT_EQUAL_UINT8(0, queue.getIndex());
+  TEST_ASSERT_TRUE(queue.set(DOSES, 1));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_doses_come_out_in_order);
+  RUN_TEST(test_refuses_invalid_counts);
+  RUN_TEST(test_refuses_a_second_batch);
+  RUN_TEST(test_offer_starts_only_when_taken);
+  RUN_TEST(test_newer_offer_replaces_one_not_taken);
+  RUN_TEST(test_offer_is_dropped_if_a_batch_started_first);
+  RUN_TEST(test_clear_ends_batch_and_offer);
+  return UNITY_END();
+}
@@ -0,0 +1,81 @@
+#include <FlowEstimator.h>
+#include <unity.h>
+
+// 10 SPS, the slowest the scale runs at
+static const int64_t PERIOD_US = 100000;
+
+void setUp() {}
+void tearDown() {}
+
+// deterministic noise in -amplitude .. amplitude
+static float noise(int i, float amplitude) {
+  return amplitude * (((i * 7919) % 201) - 100) / 100.0f;
+}
+
+void test_converges_to_a_constant_rate() {
+  FlowEstimator flow;
+  flow.reset(0.0f, 0.5f, 1.0f, 0);
+  for (int i = 1; i <= 100; ++i) {
+    flow.update(1.8f * i * PERIOD_US / 1e6f + noise(i, 0.03f), i * PERIOD_US);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 1.8f, flow.getRate());
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 18.0f, flow.getWeight());
+  TEST_ASSERT_TRUE(flow.getRateStdDev() < 0.2f);
+}
+
+void test_rate_uncertainty_shrinks_with_data() {
+  FlowEstimator flow;
+  flow.reset(0.0f, 1.0f, 1.0f, 0);
+  float initial = flow.getRateStdDev();
+  for (int i = 1; i <= 20; ++i) {
+    flow.update(1.0f * i * PERIOD_US / 1e6f, i * PERIOD_US);
+  }
+  TEST_ASSERT_TRUE(flow.getRateStdDev() < initial);
+}
+
+void test_follows_a_change_of_rate() {
+  FlowEstimator flow;
+  flow.reset(0.0f, 2.0f, 0.5f, 0);
+  float grams = 0.0f;
+  int64_t t = 0;
+  for (int i = 0; i < 50; ++i) {
+    t += PERIOD_US;
+    grams += 2.0f * PERIOD_US / 1e6f;
+    flow.update(grams, t);
+  }
+  for (int i = 0; i < 100; ++i) {
+    t += PERIOD_US;
+    grams += 1.0f * PERIOD_US / 1e6f;
+    flow.update(grams, t);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.15f, 1.0f, flow.getRate());
+}
+
+void test_predicts_when_the_target_is_reached() {
+  FlowEstimator flow;
+  flow.reset(0.0f, 2.0f, 0.1f, 0);
+  for (int i = 1; i <= 50; ++i) {
+    flow.update(2.0f * i * PERIOD_US / 1e6f, i * PERIOD_US);
+  }
+  // 10 g at 5 s, 18 g four seconds later
+  int64_t at = flow.predictTimeOf(18.0f);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 9.0f, at / 1e6f);
+}
+
+void test_no_prediction_without_flow() {
+  FlowEstimator flow;
+  flow.reset(5.0f, 0.0f, 0.01f, 0);
+  TEST_ASSERT_EQUAL(0, flow.predictTimeOf(18.0f));
+  flow.reset(5.0f, -0.1f, 0.01f, 0);
+  TEST_ASSERT_EQUAL(0, flow.predictTimeOf(18.0f));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_converges_to_a_constant_rate);
+  RUN_TEST(test_rate_uncertainty_shrinks_with_data);
+  RUN_TEST(test_follows_a_change_of_rate);
+  RUN_TEST(test_predicts_when_the_target_is_reached);
+  RUN_TEST(test_no_prediction_without_flow);
+  return UNITY_END();
+}
@@ -0,0 +1,75 @@
+#include <PulseModel.h>
+#include <Preferences.h>
+#include <unity.h>
+
+// a grinder that needs 0.2 s to deliver anything and then does 2 g/s
+static float response(float seconds) { return 2.0f * (seconds - 0.2f); }
+
+void setUp() { Preferences::wipe(); }
+void tearDown() {}
+
+void test_untrained_uses_the_rate_and_lag() {
+  PulseModel model;
+  TEST_ASSERT_FALSE(model.isTrained());
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.6f, model.predict(0.5f, 2.0f, 0.2f));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4f, 0.45f, model.solveDuration(0.5f, 2.0f, 0.2f));
+}
+
+void test_fits_offset_and_slope_from_varied_pulses() {
+  PulseModel model;
+  const float pulses[] = {0.3f, 0.5f, 0.8f, 0.4f, 1.0f, 0.6f};
+  for (float seconds : pulses) {
+    TEST_ASSERT_TRUE(model.learn(seconds, response(seconds)));
+  }
+  TEST_ASSERT_TRUE(model.isTrained());
+  // main run rate deliberately wrong, the fit must not need it
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, response(0.7f), model.predict(0.7f, 5.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.45f, model.solveDuration(0.5f, 5.0f));
+}
+
+void test_equal_pulses_fall_back_to_the_rate_as_slope() {
+  PulseModel model;
+  for (int i = 0; i < 5; ++i) {
+    model.learn(0.5f, response(0.5f));
+  }
+  // the offset is fitted through the pulses with the rate as slope
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, response(0.5f), model.predict(0.5f, 3.0f));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, response(0.5f) + 3.0f * 0.5f,
+                           model.predict(1.0f, 3.0f));
+}
+
+void test_implausible_pulses_are_rejected() {
+  PulseModel model;
+  TEST_ASSERT_FALSE(model.learn(0.0f, 0.5f));
+  TEST_ASSERT_FALSE(model.learn(PulseModel::MAX_PULSE_S + 1.0f, 0.5f));
+  TEST_ASSERT_FALSE(model.learn(0.5f, PulseModel::MAX_GRAMS + 1.0f));
+  TEST_ASSERT_FALSE(model.learn(0.5f, PulseModel::MIN_GRAMS - 1.0f));
+  TEST_ASSERT_EQUAL_UINT16(0, model.getPulses());
+}
+
+void test_state_is_stored_per_name() {
+  PulseModel model;
+  model.begin("topup");
+  for (int i = 0; i < 4; ++i) {
+    model.learn(0.5f + 0.2f * i, response(0.5f + 0.2f * i));
+  }
+
+  PulseModel restored;
+  restored.begin("topup");
+  TEST_ASSERT_EQUAL_UINT16(4, restored.getPulses());
+
+  // nothing stored under another name, the learned state must not leak
+  restored.begin("topup2");
+  TEST_ASSERT_EQUAL_UINT16(0, restored.getPulses());
+  TEST_ASSERT_FALSE(restored.isTrained());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_untrained_uses_the_rate_and_lag);
+  RUN_TEST(test_fits_offset_and_slope_from_varied_pulses);
+  RUN_TEST(test_equal_pulses_fall_back_to_the_rate_as_slope);
+  RUN_TEST(test_implausible_pulses_are_rejected);
+  RUN_TEST(test_state_is_stored_per_name);
+  return UNITY_END();
+}
@@ -0,0 +1,94 @@
+#include <ScaleFilter.h>
+#include <unity.h>
+
+using namespace scalefilter;
+
+void setUp() {}
+void tearDown() {}
+
+void test_moving_average_is_primed_with_the_first_sample() {
+  MovingAverage<4> filter;
+  TEST_ASSERT_EQUAL_INT32(1000, filter.update(1000));
+  TEST_ASSERT_EQUAL_INT32(1000, filter.update(1000));
+}
+
+void test_moving_average_step_response() {
+  MovingAverage<4> filter;
+  filter.update(0);
+  TEST_ASSERT_EQUAL_INT32(100, filter.update(400));
+  TEST_ASSERT_EQUAL_INT32(200, filter.update(400));
+  TEST_ASSERT_EQUAL_INT32(300, filter.update(400));
+  TEST_ASSERT_EQUAL_INT32(400, filter.update(400));
+  TEST_ASSERT_EQUAL_INT32(400, filter.update(400));
+}
+
+void test_cascaded_boxcar_settles_after_all_stages() {
+  CascadedBoxcar<4, 2> filter;
+  filter.update(0);
+  int32_t last = 0;
+  for (int i = 0; i < 8; ++i) {
+    int32_t y = filter.update(1600);
+    TEST_ASSERT_TRUE(y >= last);
+    last = y;
+  }
+  TEST_ASSERT_EQUAL_INT32(1600, last);
+  TEST_ASSERT_EQUAL_FLOAT(3.0f, (CascadedBoxcar<4, 2>::groupDelay()));
+}
+
+void test_iir_converges_without_overflow_on_a_full_scale_step() {
+  SinglePoleIIR<3> filter;
+  int32_t low = toQ(-8388608);
+  int32_t high = toQ(8388607);
+  filter.update(low);
+  int32_t y = low;
+  for (int i = 0; i < 400; ++i) {
+    int32_t next = filter.update(high);
+    TEST_ASSERT_TRUE(next >= y);
+    y = next;
+  }
+  TEST_ASSERT_TRUE(high - y <= 8);
+}
+
+void test_decimator_emits_one_mean_per_block() {
+  Decimator decimator;
+  decimator.configure(4, 0);
+  TEST_ASSERT_FALSE(decimator.update(10));
+  TEST_ASSERT_FALSE(decimator.update(20));
+  TEST_ASSERT_FALSE(decimator.update(30));
+  TEST_ASSERT_TRUE(decimator.update(40));
+  TEST_ASSERT_EQUAL_INT32(25, decimator.value());
+  TEST_ASSERT_TRUE(decimator.isPrimed());
+}
+
+void test_select_filter_rounds_down_to_a_supported_size() {
+  alignas(8) uint8_t storage[FILTER_STORAGE_SIZE];
+  RawFilter *filter = selectFilter(MOVING_AVERAGE, 10, storage);
+  TEST_ASSERT_EQUAL_FLOAT(MovingAverage<8>::groupDelay(),
+                          filter->groupDelay());
+  filter = selectFilter(IIR, 20, storage);
+  TEST_ASSERT_EQUAL_FLOAT(SinglePoleIIR<4>::groupDelay(),
+                          filter->groupDelay());
+}
+
+void test_scale_filter_returns_q_format() {
+  ScaleFilter filter;
+  filter.configure(8, CASCADED_BOXCAR);
+  int32_t y = 0;
+  for (int i = 0; i < 16; ++i) {
+    y = filter.update(-123456);
+  }
+  TEST_ASSERT_EQUAL_INT32(toQ(-123456), y);
+  TEST_ASSERT_EQUAL_FLOAT(-123456.0f, fromQ(y));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_moving_average_is_primed_with_the_first_sample);
+  RUN_TEST(test_moving_average_step_response);
+  RUN_TEST(test_cascaded_boxcar_settles_after_all_stages);
+  RUN_TEST(test_iir_converges_without_overflow_on_a_full_scale_step);
+  RUN_TEST(test_decimator_emits_one_mean_per_block);
+  RUN_TEST(test_select_filter_rounds_down_to_a_supported_size);
+  RUN_TEST(test_scale_filter_returns_q_format);
+  return UNITY_END();
+}
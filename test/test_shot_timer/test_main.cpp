@@ -0,0 +1,125 @@
+#include <ShotTimer.h>
+#include <unity.h>
+
+// 10 SPS, the slowest the scale runs at
+static const int64_t PERIOD_US = 100000;
+
+void setUp() {}
+void tearDown() {}
+
+// Feed a shot: nothing for waitSamples, then pour at rate for pourSamples,
+// then a still cup. Returns the sample index after the last one fed.
+static int feed(ShotTimer &timer, int waitSamples, int pourSamples,
+                float rate, int stillSamples) {
+  int i = 0;
+  float grams = 0.0f;
+  for (; i < waitSamples; ++i) {
+    timer.update(0.0f, i * PERIOD_US);
+  }
+  for (int j = 0; j < pourSamples; ++i, ++j) {
+    grams += rate * PERIOD_US / 1e6f;
+    timer.update(grams, i * PERIOD_US);
+  }
+  for (int j = 0; j < stillSamples; ++i, ++j) {
+    timer.update(grams, i * PERIOD_US);
+  }
+  return i;
+}
+
+void test_waits_for_the_first_drip() {
+  ShotTimer timer;
+  timer.update(0.0f, 0);
+  timer.update(ShotTimer::START_G - 0.1f, PERIOD_US);
+  TEST_ASSERT_EQUAL(ShotTimer::WAITING, timer.getPhase());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, timer.getSeconds());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, timer.getFlow());
+  timer.update(ShotTimer::START_G, 2 * PERIOD_US);
+  TEST_ASSERT_EQUAL(ShotTimer::POURING, timer.getPhase());
+}
+
+void test_times_a_shot_from_first_to_last_drip() {
+  ShotTimer timer;
+  // 25 s at 1.6 g/s, then a still cup well past the hold
+  feed(timer, 30, 250, 1.6f, 60);
+  TEST_ASSERT_EQUAL(ShotTimer::DONE, timer.getPhase());
+  const ShotTimer::Summary &summary = timer.getSummary();
+  // the flow estimate lags the end of the pour a little
+  TEST_ASSERT_FLOAT_WITHIN(1.5f, 25.0f, summary.seconds);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 40.0f, summary.weight);
+  TEST_ASSERT_FLOAT_WITHIN(0.15f, 1.6f, summary.averageFlow);
+  TEST_ASSERT_FLOAT_WITHIN(0.3f, 1.6f, summary.peakFlow);
+  TEST_ASSERT_EQUAL_FLOAT(summary.seconds, timer.getSeconds());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, timer.getFlow());
+}
+
+void test_keeps_pouring_through_a_short_pause() {
+  ShotTimer timer;
+  // still for less than the hold
+  int still = ShotTimer::END_HOLD_US / PERIOD_US / 2;
+  int i = feed(timer, 0, 100, 2.0f, still);
+  TEST_ASSERT_EQUAL(ShotTimer::POURING, timer.getPhase());
+  TEST_ASSERT_TRUE(timer.getSeconds() > 10.0f);
+  // and pour again
+  float grams = 20.0f;
+  for (int j = 0; j < 50; ++j, ++i) {
+    grams += 2.0f * PERIOD_US / 1e6f;
+    timer.update(grams, i * PERIOD_US);
+  }
+  TEST_ASSERT_EQUAL(ShotTimer::POURING, timer.getPhase());
+}
+
+void test_lifting_the_cup_keeps_the_weight() {
+  ShotTimer timer;
+  feed(timer, 0, 200, 1.8f, 0);
+  int64_t t = 200 * PERIOD_US;
+  for (int j = 0; j < 60; ++j) {
+    t += PERIOD_US;
+    timer.update(-150.0f, t);
+  }
+  TEST_ASSERT_EQUAL(ShotTimer::DONE, timer.getPhase());
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 36.0f, timer.getSummary().weight);
+}
+
+void test_stop_ends_the_shot_at_the_last_sample() {
+  ShotTimer timer;
+  feed(timer, 0, 100, 2.0f, 0);
+  timer.stop();
+  TEST_ASSERT_EQUAL(ShotTimer::DONE, timer.getPhase());
+  // 0.4 g at sample 1 is the first drip, sample 99 the last one
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 9.8f, timer.getSummary().seconds);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 20.0f, timer.getSummary().weight);
+
+  // nothing changes once done
+  timer.update(50.0f, 200 * PERIOD_US);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 20.0f, timer.getSummary().weight);
+}
+
+void test_stop_before_the_shot_does_nothing() {
+  ShotTimer timer;
+  timer.update(0.0f, 0);
+  timer.stop();
+  TEST_ASSERT_EQUAL(ShotTimer::WAITING, timer.getPhase());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, timer.getSummary().seconds);
+}
+
+void test_reset_waits_for_the_next_shot() {
+  ShotTimer timer;
+  feed(timer, 0, 100, 2.0f, 60);
+  TEST_ASSERT_EQUAL(ShotTimer::DONE, timer.getPhase());
+  timer.reset();
+  TEST_ASSERT_EQUAL(ShotTimer::WAITING, timer.getPhase());
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, timer.getSummary().weight);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, timer.getSummary().peakFlow);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_waits_for_the_first_drip);
+  RUN_TEST(test_times_a_shot_from_first_to_last_drip);
+  RUN_TEST(test_keeps_pouring_through_a_short_pause);
+  RUN_TEST(test_lifting_the_cup_keeps_the_weight);
+  RUN_TEST(test_stop_ends_the_shot_at_the_last_sample);
+  RUN_TEST(test_stop_before_the_shot_does_nothing);
+  RUN_TEST(test_reset_waits_for_the_next_shot);
+  return UNITY_END();
+}
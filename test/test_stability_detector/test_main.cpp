@@ -0,0 +1,97 @@
+#include <StabilityDetector.h>
+#include <unity.h>
+
+// 1000 counts per gram on top of a large ADC offset
+static const float GRAMS_PER_COUNT = 0.001f;
+static const int32_t EMPTY = 812345;
+static const int32_t CUP = 250000;  // 250 g
+static const int64_t PERIOD_US = 12500;  // 80 SPS
+
+static StabilityDetector detector;
+static int64_t now_us;
+static int sample;
+
+void setUp() {
+  detector.configure(24, GRAMS_PER_COUNT, 0.03f, 0.5f);
+  now_us = 0;
+  sample = 0;
+}
+void tearDown() {}
+
+// deterministic noise of a few counts, well below the threshold
+static int32_t noise() {
+  ++sample;
+  return ((sample * 7919) % 11) - 5;
+}
+
+static void feed(int32_t raw, int count) {
+  for (int i = 0; i < count; ++i) {
+    now_us += PERIOD_US;
+    detector.update(raw + noise(), now_us);
+  }
+}
+
+// a cup landing or leaving over a few samples, as the filter would pass it
+static void ramp(int32_t from, int32_t to, int count) {
+  for (int i = 1; i <= count; ++i) {
+    now_us += PERIOD_US;
+    detector.update(from + (int64_t)(to - from) * i / count, now_us);
+  }
+}
+
+void test_not_stable_until_the_window_is_full() {
+  feed(EMPTY, 23);
+  TEST_ASSERT_FALSE(detector.isStable());
+  feed(EMPTY, 1);
+  TEST_ASSERT_TRUE(detector.isStable());
+  TEST_ASSERT_TRUE(detector.getConfidence() > 0.0f);
+}
+
+void test_mean_is_in_raw_counts() {
+  feed(EMPTY, 48);
+  TEST_ASSERT_FLOAT_WITHIN(2.0f, EMPTY, detector.getMean());
+}
+
+void test_a_step_is_not_stable() {
+  feed(EMPTY, 48);
+  ramp(EMPTY, EMPTY + CUP, 4);
+  TEST_ASSERT_FALSE(detector.isStable());
+  TEST_ASSERT_TRUE(detector.getStdDev() > 0.03f);
+}
+
+void test_recovers_after_repeated_cup_cycles() {
+  feed(EMPTY, 48);
+  for (int cycle = 0; cycle < 20; ++cycle) {
+    ramp(EMPTY, EMPTY + CUP, 4);
+    feed(EMPTY + CUP, 48);
+    TEST_ASSERT_TRUE(detector.isStable());
+    TEST_ASSERT_TRUE(detector.getStdDev() < 0.01f);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, EMPTY + CUP, detector.getMean());
+
+    ramp(EMPTY + CUP, EMPTY, 4);
+    feed(EMPTY, 48);
+    TEST_ASSERT_TRUE(detector.isStable());
+    TEST_ASSERT_TRUE(detector.getStdDev() < 0.01f);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, EMPTY, detector.getMean());
+  }
+}
+
+void test_a_slow_drift_is_caught_by_the_slope() {
+  // 1 g/s, far above the 0.5 g/s limit but quiet within the window
+  for (int i = 0; i < 96; ++i) {
+    now_us += PERIOD_US;
+    detector.update(EMPTY + i * 12, now_us);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 0.96f, detector.getSlope());
+  TEST_ASSERT_FALSE(detector.isStable());
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_not_stable_until_the_window_is_full);
+  RUN_TEST(test_mean_is_in_raw_counts);
+  RUN_TEST(test_a_step_is_not_stable);
+  RUN_TEST(test_recovers_after_repeated_cup_cycles);
+  RUN_TEST(test_a_slow_drift_is_caught_by_the_slope);
+  return UNITY_END();
+}
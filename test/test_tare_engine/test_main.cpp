@@ -0,0 +1,99 @@
+#include <TareEngine.h>
+#include <unity.h>
+
+static const float GRAMS_PER_COUNT = 0.001f;
+static const int32_t ZERO = 812345;
+
+static TareEngine tare;
+static int sample;
+
+void setUp() {
+  tare.configure(GRAMS_PER_COUNT, 0.03f, 0.005f, 8);
+  sample = 0;
+}
+void tearDown() {}
+
+// deterministic noise of +-5 counts, 0.005 g
+static int32_t noise() {
+  ++sample;
+  return ((sample * 7919) % 11) - 5;
+}
+
+// feed until done, returns the number of samples it took or -1
+static int feedUntilDone(int32_t raw, int limit) {
+  for (int i = 1; i <= limit; ++i) {
+    if (tare.update(raw + noise())) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void test_completes_on_a_quiet_signal() {
+  tare.start();
+  int samples = feedUntilDone(ZERO, 100);
+  TEST_ASSERT_TRUE(samples >= 8);
+  TEST_ASSERT_TRUE(tare.isDone());
+  TEST_ASSERT_FALSE(tare.isRunning());
+  TEST_ASSERT_FLOAT_WITHIN(2.0f, ZERO, tare.getOffset());
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, tare.getProgress());
+}
+
+void test_an_outlier_restarts_the_accumulation() {
+  tare.start();
+  for (int i = 0; i < 5; ++i) {
+    tare.update(ZERO + noise());
+  }
+  // the cup is still being put down
+  tare.update(ZERO + 20000);
+  TEST_ASSERT_EQUAL_UINT16(1, tare.getSampleCount());
+  int samples = feedUntilDone(ZERO + 20000, 100);
+  TEST_ASSERT_TRUE(samples > 0);
+  TEST_ASSERT_FLOAT_WITHIN(2.0f, ZERO + 20000, tare.getOffset());
+}
+
+void test_a_noisy_signal_never_completes() {
+  tare.start();
+  for (int i = 0; i < 200; ++i) {
+    // +-40 counts, above the 0.03 g limit but not an outlier
+    tare.update(ZERO + (i % 2 ? 40 : -40));
+  }
+  TEST_ASSERT_FALSE(tare.isDone());
+  TEST_ASSERT_TRUE(tare.getProgress() < 1.0f);
+}
+
+void test_continuous_mode_keeps_running_and_follows_drift() {
+  tare.start(true);
+  int32_t raw = ZERO;
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 10 == 0) {
+      ++raw;
+    }
+    tare.update(raw + noise());
+  }
+  TEST_ASSERT_TRUE(tare.isRunning());
+  TEST_ASSERT_TRUE(tare.isDone());
+  TEST_ASSERT_EQUAL_UINT16(TareEngine::CONTINUOUS_SAMPLES,
+                           tare.getSampleCount());
+  // memory of 64 samples lags a 0.1 count / sample drift by about 6 counts
+  TEST_ASSERT_FLOAT_WITHIN(10.0f, raw, tare.getOffset());
+}
+
+void test_stop_clears_the_result() {
+  tare.start();
+  feedUntilDone(ZERO, 100);
+  tare.stop();
+  TEST_ASSERT_FALSE(tare.isDone());
+  TEST_ASSERT_FALSE(tare.isRunning());
+  TEST_ASSERT_FALSE(tare.update(ZERO));
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_completes_on_a_quiet_signal);
+  RUN_TEST(test_an_outlier_restarts_the_accumulation);
+  RUN_TEST(test_a_noisy_signal_never_completes);
+  RUN_TEST(test_continuous_mode_keeps_running_and_follows_drift);
+  RUN_TEST(test_stop_clears_the_result);
+  return UNITY_END();
+}
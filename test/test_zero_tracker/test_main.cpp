@@ -0,0 +1,102 @@
+#include <Preferences.h>
+#include <ZeroTracker.h>
+#include <unity.h>
+
+// 10 SPS, 0.001 g per count and an empty scale far from raw zero
+static const int64_t PERIOD_US = 100000;
+static const float GRAMS_PER_COUNT = 0.001f;
+static const float EMPTY = 812345.0f;
+static const float BAND_G = 0.5f;
+static const float TAU_S = 60.0f;
+
+void setUp() { Preferences::wipe(); }
+void tearDown() {}
+
+static ZeroTracker makeTracker() {
+  ZeroTracker tracker;
+  tracker.begin();
+  tracker.configure(GRAMS_PER_COUNT, BAND_G, TAU_S);
+  return tracker;
+}
+
+// Feed count stable means from sample first on, returns the next sample
+static int feed(ZeroTracker &tracker, float mean, int first, int count) {
+  for (int i = first; i < first + count; ++i) {
+    tracker.update(mean, true, (i + 1) * PERIOD_US);
+  }
+  return first + count;
+}
+
+void test_first_stable_reading_is_the_zero() {
+  ZeroTracker tracker = makeTracker();
+  TEST_ASSERT_FALSE(tracker.hasOffset());
+  TEST_ASSERT_FALSE(tracker.update(EMPTY + 7.0f, false, PERIOD_US));
+  TEST_ASSERT_TRUE(tracker.update(EMPTY + 7.0f, true, 2 * PERIOD_US));
+  TEST_ASSERT_TRUE(tracker.hasOffset());
+  TEST_ASSERT_TRUE(tracker.isEmpty());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, EMPTY + 7.0f, tracker.getOffset());
+}
+
+void test_follows_a_slow_drift_of_a_few_counts() {
+  ZeroTracker tracker = makeTracker();
+  int i = feed(tracker, EMPTY, 0, 1);
+  // 10 counts are 0.01 g, each update moves the zero by well below the step
+  // of a float at these counts
+  feed(tracker, EMPTY + 10.0f, i, 5 * TAU_S * 1e6f / PERIOD_US);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, EMPTY + 10.0f, tracker.getOffset());
+}
+
+void test_ignores_a_load_outside_the_band() {
+  ZeroTracker tracker = makeTracker();
+  int i = feed(tracker, EMPTY, 0, 1);
+  float load = EMPTY + 2.0f * BAND_G / GRAMS_PER_COUNT;
+  TEST_ASSERT_FALSE(tracker.update(load, true, (i + 1) * PERIOD_US));
+  TEST_ASSERT_FALSE(tracker.isEmpty());
+  feed(tracker, load, i + 1, 1000);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, EMPTY, tracker.getOffset());
+}
+
+void test_follows_a_drift_larger_than_the_rebase_step() {
+  ZeroTracker tracker = makeTracker();
+  int i = feed(tracker, EMPTY, 0, 1);
+  // 0.4 g steps within the band, 2000 counts in all
+  for (int step = 1; step <= 5; ++step) {
+    i = feed(tracker, EMPTY + 400.0f * step, i, 6000);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, EMPTY + 2000.0f, tracker.getOffset());
+}
+
+void test_saved_zero_is_restored() {
+  {
+    ZeroTracker tracker = makeTracker();
+    feed(tracker, EMPTY + 0.5f, 0, 1);
+    tracker.save(true);
+  }
+  ZeroTracker tracker;
+  TEST_ASSERT_TRUE(tracker.begin());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, EMPTY + 0.5f, tracker.getOffset());
+}
+
+void test_startup_far_from_the_saved_zero_keeps_it() {
+  {
+    ZeroTracker tracker = makeTracker();
+    feed(tracker, EMPTY, 0, 1);
+    tracker.save(true);
+  }
+  ZeroTracker tracker = makeTracker();
+  // a cup left on the scale over a power cycle
+  float cup = EMPTY + 2.0f * ZeroTracker::STARTUP_RANGE_G / GRAMS_PER_COUNT;
+  TEST_ASSERT_FALSE(tracker.update(cup, true, PERIOD_US));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, EMPTY, tracker.getOffset());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_first_stable_reading_is_the_zero);
+  RUN_TEST(test_follows_a_slow_drift_of_a_few_counts);
+  RUN_TEST(test_ignores_a_load_outside_the_band);
+  RUN_TEST(test_follows_a_drift_larger_than_the_rebase_step);
+  RUN_TEST(test_saved_zero_is_restored);
+  RUN_TEST(test_startup_far_from_the_saved_zero_keeps_it);
+  return UNITY_END();
+}